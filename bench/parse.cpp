@@ -0,0 +1,137 @@
+// Measures how fast socket commands are parsed: tokenized with
+// utils::tokenize, then their identifiers read with usb::address::from and
+// their numbers with utils::parse_number, the way the command handlers do it.
+//
+// Build it with `./build.sh bench`, then run ./openfdd-bench-parse
+
+#include "usb/address.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+
+namespace
+{
+
+std::atomic<std::size_t> allocation_count = 0;
+
+// A command as a client sends it, and which of its arguments are numbers
+struct recorded_command {
+	std::string_view line;
+
+	// Index of the device identifier (bus:device), 0 if there's none
+	std::size_t identifier = 0;
+
+	// Arguments from this one on are numbers, 0 if there are none
+	std::size_t numbers_from = 0;
+};
+
+// Roughly what a settings GUI and a lighting effect send over a session:
+// mostly status/state queries and color updates, some setting changes
+constexpr recorded_command command_mix[] = {
+    {"ping"},
+    {"list-devices"},
+    {"describe-all"},
+    {"list-actions,001:004", 1},
+    {"list-actions-if-changed,001:004,5f1c2a9e", 1},
+    {"list-action-params,001:004,dpi_profile", 1},
+    {"get-state,001:004", 1},
+    {"get-status,001:004", 1},
+    {"get-status,001:007", 1},
+    {"action-run,001:004,dpi_profile,3", 1, 3},
+    {"action-run,001:004,2,3", 1, 2},
+    {"action-run,001:004,define_dpi_profile,2,1600", 1, 3},
+    {"action-run,001:004,lighting_color,1,FF8000", 1},
+    {"action-run,001:004,lighting_color,2,00FF80", 1},
+    {"action-run,001:004,lighting_color,3,8000FF", 1},
+    {"action-run,001:007,poll_interval,1", 1, 3},
+    {"action-run,001:007,sleep_time,300", 1, 3},
+    {"action-run-many,all,save"},
+    {"action-run-many,001:004;001:007,save"},
+    {"capability-apply,all,dpi-profiles,400,800,1200,2400,3200", 0, 3},
+    {"capability-apply,type=steelseries:aerox_3_wireless,poll-interval,1",
+     0,
+     3},
+    {"action-run,002:003,backlight_luminosity,5", 1, 3},
+    {"subscribe,events,drop"},
+    {"subscribe-events,001:004", 1},
+    {"stats"},
+};
+
+// Keeps the compiler from optimizing the parsing away
+std::uint64_t checksum = 0;
+
+void parse(std::string& line, recorded_command const& command)
+{
+	auto const argv = utils::tokenize(line, ',');
+	checksum += argv.size();
+
+	if (command.identifier > 0) {
+		auto const address = usb::address::from(argv[command.identifier]);
+		checksum += address.bus + address.device;
+	}
+
+	if (command.numbers_from > 0)
+		for (auto i = command.numbers_from; i < argv.size(); ++i)
+			checksum += utils::parse_number<std::uint32_t>(
+			    argv[i], {.min = 0}, "Value");
+}
+
+} // namespace
+
+// Counts allocations, so we can check parsing doesn't make any
+void* operator new(std::size_t size)
+{
+	++allocation_count;
+	if (auto* const memory = std::malloc(size ? size : 1)) return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+int main(int argc, char** argv)
+{
+	auto const rounds = argc > 1 ? utils::parse_number<std::size_t>(
+	                                   argv[1], {.min = 1}, "Rounds")
+	                             : 200'000;
+
+	// Lines are copied into a buffer reused between commands, so only the
+	// parsing is measured, not reading from the socket
+	std::string line;
+	line.reserve(256);
+
+	auto const allocations_before = allocation_count.load();
+	auto const start              = std::chrono::steady_clock::now();
+
+	for (std::size_t round = 0; round < rounds; ++round) {
+		for (auto const& command : command_mix) {
+			line.assign(command.line);
+			parse(line, command);
+		}
+	}
+
+	auto const elapsed     = std::chrono::steady_clock::now() - start;
+	auto const commands    = rounds * std::size(command_mix);
+	auto const allocations = allocation_count.load() - allocations_before;
+
+	auto const nanoseconds =
+	    std::chrono::duration<double, std::nano>(elapsed).count();
+
+	std::cout << commands << " commands in " << nanoseconds / 1e6 << " ms\n"
+	          << nanoseconds / commands << " ns per command, "
+	          << commands / (nanoseconds / 1e9) << " commands per second\n"
+	          << static_cast<double>(allocations) / commands
+	          << " allocations per command\n"
+	          << "(checksum: " << checksum << ")\n";
+}
@@ -29,8 +29,20 @@ build_release() {
 		 -o openfdd
 }
 
+# Parsing benchmark, see bench/parse.cpp
+build_bench() {
+	$CXX bench/parse.cpp src/utils.cpp src/logger.cpp \
+		 -Isrc/                       \
+		 -Wall -Wextra                \
+		 -std=c++20 -pedantic         \
+		 -O2                          \
+		 -o openfdd-bench-parse
+}
+
 if [ "$1" = "dev" ]; then
 	build_dev;
+elif [ "$1" = "bench" ]; then
+	build_bench;
 else
 	build_release;
 fi;
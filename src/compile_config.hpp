@@ -1,5 +1,7 @@
 #pragma once
 
+#include <syslog.h>
+
 // Compile time configuration
 namespace compile_config
 {
@@ -12,4 +14,14 @@ auto constexpr use_daemon = true;
 #endif
 // ---
 
+// LOGGING
+// Messages less important than this are compiled out (ex. with
+// -DMAX_LOG_LEVEL=LOG_NOTICE)
+#ifdef MAX_LOG_LEVEL
+auto constexpr max_log_level = MAX_LOG_LEVEL;
+#else
+auto constexpr max_log_level = LOG_DEBUG;
+#endif
+// ---
+
 } // namespace compile_config
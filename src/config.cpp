@@ -1,5 +1,6 @@
 #include "config.hpp"
 #include "3rd_party/json.hpp"
+#include "metrics.hpp"
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
@@ -50,6 +51,23 @@ nlohmann::json config_manager::get_device_config(std::string config_id) const
 void config_manager::update_config(std::string           config_id,
                                    nlohmann::json const& config) const
 {
-	std::ofstream config_output(m_path + config_id + ".json");
-	config_output << config;
+	{
+		metrics::scoped_timer timer(metrics::get_histogram(
+		    "openfdd_config_write_duration_seconds", {{"config", config_id}}));
+
+		std::lock_guard lock(m_write_mutex);
+
+		// Written next to the config, then renamed over it, so the config
+		// is never seen half-written, even if we exit in the middle of this
+		// (ex. when handing over to a new daemon)
+		auto const path           = m_path + config_id + ".json";
+		auto const temporary_path = path + ".tmp";
+		{
+			std::ofstream config_output(temporary_path);
+			config_output << config;
+		}
+		std::filesystem::rename(temporary_path, path);
+	}
+
+	if (m_update_listener) m_update_listener(config_id);
 }
@@ -2,7 +2,9 @@
 
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <ios>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -26,6 +28,19 @@ class config_manager
 	void update_config(std::string           config_id,
 	                   nlohmann::json const& config) const;
 
+	// Called with the config ID every time a config gets updated
+	void set_update_listener(
+	    std::function<void(std::string const& config_id)> listener) noexcept
+	{
+		m_update_listener = listener;
+	}
+
   private:
 	std::string m_path;
+
+	// Drivers of the same type share a config file, and may be updated
+	// concurrently (see action-run-many)
+	mutable std::mutex m_write_mutex;
+
+	std::function<void(std::string const& config_id)> m_update_listener;
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "drivers/driver.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace drivers
+{
+
+// Capabilities are features shared by many devices, whatever their model.
+// Unlike actions, which are specific to a driver, they have the same meaning
+// (and the same units) for every driver implementing them, so a client can
+// use them without knowing anything about the device.
+//
+// Drivers implement a capability by inheriting from it. The apply_*
+// functions update the device and save the new value to the config, like the
+// actions doing the same thing, and tell whether the device got it or it was
+// queued until the device wakes up.
+namespace capabilities
+{
+
+// Several DPI profiles, that the user switches between
+class dpi_table
+{
+  public:
+	virtual ~dpi_table() = default;
+
+	virtual std::size_t dpi_profile_count() const noexcept = 0;
+
+	// Sets the DPI of the profiles, starting from the first one. Profiles
+	// after the given values are left as they are.
+	virtual delivery apply_dpi_profiles(
+	    std::span<std::uint16_t const> dpis) = 0;
+
+	// Profiles are numbered from 1
+	virtual delivery apply_active_dpi_profile(std::uint8_t profile) = 0;
+};
+
+// Lights whose color can be set per zone
+class zone_lighting
+{
+  public:
+	virtual ~zone_lighting() = default;
+
+	virtual std::size_t lighting_zone_count() const noexcept = 0;
+
+	// Sets the color of a zone, from 0 to lighting_zone_count() - 1, without
+	// saving it to the config. This is meant for effects streamed at a high
+	// rate (see frame_ring), which shouldn't hit the disk on every frame.
+	virtual void set_zone_color(std::size_t zone, rgb const& color) const = 0;
+
+	// Sets every zone to the color
+	virtual delivery apply_lighting_color(rgb const& color) = 0;
+};
+
+// How often the device reports to the host
+class poll_rate
+{
+  public:
+	virtual ~poll_rate() = default;
+
+	// Interval between polls, in milliseconds, from 1 to 4
+	virtual delivery apply_poll_interval(std::uint8_t interval_ms) = 0;
+};
+
+// Devices going to sleep after some time without being used
+class sleep_timeout
+{
+  public:
+	virtual ~sleep_timeout() = default;
+
+	virtual delivery apply_sleep_timeout(std::uint32_t seconds) = 0;
+};
+
+// Settings can be saved to the device's memory, to be kept without openfdd
+class onboard_save
+{
+  public:
+	virtual ~onboard_save() = default;
+
+	virtual delivery save_to_onboard_memory() = 0;
+};
+
+// Devices running on a battery, which report its level when asked
+class battery_status
+{
+  public:
+	virtual ~battery_status() = default;
+
+	// The level is reported later, as a battery event (see device_event)
+	virtual void request_battery_status() const = 0;
+};
+
+// The capability, if the driver has it
+template <typename capability> capability* get(driver& target) noexcept
+{
+	return dynamic_cast<capability*>(&target);
+}
+
+template <typename capability>
+capability const* get(driver const& target) noexcept
+{
+	return dynamic_cast<capability const*>(&target);
+}
+
+} // namespace capabilities
+} // namespace drivers
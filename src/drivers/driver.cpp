@@ -1,25 +1,246 @@
 #include "driver.hpp"
+#include "metrics.hpp"
+#include <charconv>
+#include <cstdio>
 #include <stdexcept>
+#include <system_error>
 
 namespace drivers
 {
 
-void driver::run_action(std::string const&              action_id,
-                        std::vector<std::string> const& parameters)
+void driver::initialize()
 {
-	if (!m_action_handlers.contains(action_id))
-		throw std::runtime_error("Unexpected action: " + action_id);
+	// If this throws, the next call tries again
+	std::call_once(m_initialized, [this]() {
+		m_action_durations.clear();
+		for (auto const& action : get_actions())
+			m_action_durations.push_back(&metrics::get_histogram(
+			    "openfdd_action_duration_seconds",
+			    {{"driver", config_id()}, {"action", action.id}}));
 
-	auto handler = m_action_handlers.at(action_id);
-	return handler(parameters);
+		m_device->open();
+		deserialize_config(m_config_manager->get_device_config(config_id()));
+
+		try {
+			start_event_reader();
+		} catch (std::runtime_error const& e) {
+			// Not fatal, the device is still usable without events
+			utils::daemon::log("Couldn't read events",
+			                   {{"device", name()}, {"error", e.what()}},
+			                   utils::daemon::log_level::error);
+		}
+	});
+}
+
+std::optional<std::size_t> driver::find_action(
+    std::string_view id_or_index) const noexcept
+{
+	auto const actions = get_actions();
+
+	// Action ids are never numbers, so there's no ambiguity
+	std::size_t index = 0;
+	auto const* const input_end = id_or_index.data() + id_or_index.size();
+	auto const [end, error] =
+	    std::from_chars(id_or_index.data(), input_end, index);
+	if (!id_or_index.empty() && error == std::errc{} && end == input_end) {
+		if (index < actions.size()) return index;
+		return {};
+	}
+
+	// Tables are small, a linear search is as fast as hashing the id
+	for (std::size_t i = 0; i < actions.size(); ++i)
+		if (actions[i].id == id_or_index) return i;
+
+	return {};
+}
+
+delivery driver::run_action(std::size_t                       action_index,
+                            std::span<std::string_view const> parameters)
+{
+	auto const actions = get_actions();
+	if (action_index >= actions.size())
+		throw std::runtime_error("Unexpected action: " +
+		                         std::to_string(action_index));
+
+	return run(action_index,
+	           actions[action_index].parse_arguments(parameters));
+}
+
+delivery driver::run_action(std::size_t action_index, arguments const& args)
+{
+	auto const actions = get_actions();
+	if (action_index >= actions.size())
+		throw std::runtime_error("Unexpected action: " +
+		                         std::to_string(action_index));
+
+	actions[action_index].validate_arguments(args);
+	return run(action_index, args);
+}
+
+delivery driver::run(std::size_t action_index, arguments const& args)
+{
+	initialize();
+
+	metrics::scoped_timer timer(*m_action_durations[action_index]);
+
+	auto const guard = lock();
+	return get_actions()[action_index].run(*this, args);
+}
+
+std::shared_ptr<std::string const> driver::get_state()
+{
+	// Settings aren't known before the config is loaded
+	initialize();
+
+	auto const guard = lock();
+
+	if (!m_state) {
+		state_writer writer;
+		write_state(writer);
+		m_state = std::make_shared<std::string const>(writer.str());
+	}
+
+	return m_state;
+}
+
+void driver::start_event_reader()
+{
+	auto const source = get_event_source();
+	if (!source.has_value() || m_event_reader) return;
+
+	// The decoder is a plain function, and m_events outlives the reader (see
+	// driver.hpp), so reports handled on the libusb event thread never touch
+	// the driver while it's being destroyed.
+	auto const decode = source->decode;
+	auto&      events = m_events;
+
+	m_event_reader = std::make_unique<usb::interrupt_reader>(
+	    m_device,
+	    source->interface,
+	    [decode, &events](std::span<std::uint8_t const> report) {
+		    auto const event = decode(report);
+		    if (event.has_value()) events.publish(event.value());
+	    });
+}
+
+argument parameter::parse(std::string_view input) const
+{
+	switch (type) {
+	case uint:
+		return utils::parse_number<std::uint32_t>(
+		    input,
+		    {.min = type_info.uint.min, .max = type_info.uint.max},
+		    name);
+	case string:
+		return input;
+	case rgb_color: {
+		if (input.size() != 6)
+			throw std::runtime_error(std::string(name) +
+			                         " should be 6 hex digits (got: " +
+			                         std::string(input) + ")");
+
+		rgb color;
+		for (std::size_t i = 0; i < color.size(); ++i)
+			color[i] = utils::parse_number<std::uint8_t>(
+			    input.substr(i * 2, 2), {}, name, 16);
+		return color;
+	}
+	case bool_:
+		if (input == "true") return true;
+		if (input == "false") return false;
+		throw std::runtime_error(std::string(name) +
+		                         " should be 'true' or 'false' (got: " +
+		                         std::string(input) + ")");
+	case enum_: {
+		auto const& values = type_info.enum_.values;
+
+		auto const index = type_info.enum_.find(input);
+		if (index.has_value()) return enum_value{index.value()};
+
+		// Clients can also send the index of the value directly
+		std::size_t       ordinal   = 0;
+		auto const* const input_end = input.data() + input.size();
+		auto const [end, error] =
+		    std::from_chars(input.data(), input_end, ordinal);
+		if (!input.empty() && error == std::errc{} && end == input_end &&
+		    ordinal < values.size())
+			return enum_value{ordinal};
+
+		std::string allowed;
+		for (auto const& value : values)
+			allowed += (allowed.empty() ? "" : ", ") + std::string(value);
+
+		throw std::runtime_error(std::string(name) + " should be one of " +
+		                         allowed + " (got: " + std::string(input) +
+		                         ")");
+	}
+	}
+
+	throw std::runtime_error("Unknown type for " + std::string(name));
+}
+
+void parameter::validate(argument const& value) const
+{
+	auto const has_right_type = [&]() {
+		switch (type) {
+		case uint:
+			return std::holds_alternative<std::uint32_t>(value);
+		case string:
+			return std::holds_alternative<std::string_view>(value);
+		case rgb_color:
+			return std::holds_alternative<rgb>(value);
+		case bool_:
+			return std::holds_alternative<bool>(value);
+		case enum_:
+			return std::holds_alternative<enum_value>(value);
+		}
+		return false;
+	}();
+
+	if (!has_right_type)
+		throw std::runtime_error(std::string(name) + " should be of type " +
+		                         type_to_string(type));
+
+	if (type == uint)
+		utils::ensure_range(std::get<std::uint32_t>(value),
+		                    type_info.uint.min,
+		                    type_info.uint.max,
+		                    std::string(name));
+
+	if (type == enum_) {
+		auto const index = std::get<enum_value>(value).index;
+		if (index >= type_info.enum_.values.size())
+			throw std::runtime_error(std::string(name) + " has no value " +
+			                         std::to_string(index));
+	}
 }
 
-void driver::register_action(std::string const&     id,
-                             action const&          the_action,
-                             action::handler const& handler)
+arguments action::parse_arguments(
+    std::span<std::string_view const> inputs) const
 {
-	m_actions.insert({id, the_action});
-	m_action_handlers.insert({id, handler});
+	if (inputs.size() != parameters.size())
+		throw std::runtime_error(std::string(name) + " takes " +
+		                         std::to_string(parameters.size()) +
+		                         " arguements (got: " +
+		                         std::to_string(inputs.size()) + ")");
+
+	arguments parsed;
+	for (std::size_t i = 0; i < parameters.size(); ++i)
+		parsed.push_back(parameters[i].parse(inputs[i]));
+
+	return parsed;
+}
+
+void action::validate_arguments(arguments const& args) const
+{
+	if (args.size() != parameters.size())
+		throw std::runtime_error(std::string(name) + " takes " +
+		                         std::to_string(parameters.size()) +
+		                         " arguements (got: " +
+		                         std::to_string(args.size()) + ")");
+
+	for (std::size_t i = 0; i < parameters.size(); ++i)
+		parameters[i].validate(args[i]);
 }
 
 std::string const parameter::type_to_string(enum type const& t) noexcept
@@ -33,7 +254,46 @@ std::string const parameter::type_to_string(enum type const& t) noexcept
 		return "rgb_color";
 	case bool_:
 		return "bool";
+	case enum_:
+		return "enum";
 	}
 	return "unknown";
 }
+
+void state_writer::uint(std::string_view name, std::uint32_t value)
+{
+	m_output.append(name).append(1, ',');
+	m_output.append(std::to_string(value)).append(1, '\n');
+}
+
+void state_writer::bool_(std::string_view name, bool value)
+{
+	m_output.append(name).append(value ? ",true\n" : ",false\n");
+}
+
+void state_writer::rgb_color(std::string_view name, rgb const& color)
+{
+	// Same format as rgb_color parameters (ex. FF0000)
+	char hex[7];
+	std::snprintf(
+	    hex, sizeof(hex), "%02X%02X%02X", color[0], color[1], color[2]);
+
+	m_output.append(name).append(1, ',').append(hex).append(1, '\n');
+}
+
+void state_writer::string(std::string_view name, std::string_view value)
+{
+	m_output.append(name).append(1, ',');
+	m_output.append(utils::escape_commas(value)).append(1, '\n');
+}
+
+void state_writer::uint_list(std::string_view               name,
+                             std::span<std::uint16_t const> values)
+{
+	m_output.append(name);
+	for (auto const value : values)
+		m_output.append(1, ',').append(std::to_string(value));
+	m_output.append(1, '\n');
+}
+
 } // namespace drivers
@@ -2,24 +2,141 @@
 
 #include "3rd_party/json.hpp"
 #include "config.hpp"
+#include "drivers/events.hpp"
 #include "usb/device.hpp"
+#include "usb/interrupt_reader.hpp"
+#include "utils.hpp"
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <variant>
 #include <vector>
 
+namespace metrics
+{
+class histogram;
+} // namespace metrics
+
 namespace drivers
 {
 
+typedef std::array<std::uint8_t, 3> rgb;
+
+// Whether what an action or capability changed reached the device, or waits
+// for it to wake up (see driver::is_asleep())
+enum delivery {
+	sent,
+	queued,
+};
+
+// The value of an enum parameter: the index of the value in its list
+struct enum_value {
+	std::size_t index;
+};
+
+// A parameter value, as given to an action handler. Its type matches the
+// parameter's type: uint -> std::uint32_t, bool_ -> bool, rgb_color -> rgb,
+// string -> std::string_view, enum_ -> enum_value.
+typedef std::variant<std::uint32_t, bool, rgb, std::string_view, enum_value>
+    argument;
+
+// The values an enum parameter can take, with a perfect hash table to find a
+// value's index with a single probe. Use enum_values to build it.
+struct enum_typeinfo {
+	static constexpr std::uint8_t empty_slot = 0xff;
+
+	std::span<std::string_view const> values;
+	std::span<std::uint8_t const>     slots;
+	std::uint32_t                     seed = 0;
+
+	static constexpr std::uint32_t hash(std::string_view value,
+	                                    std::uint32_t    seed) noexcept
+	{
+		// FNV-1a, with the seed mixed into the offset basis
+		auto result = 2166136261u ^ seed;
+		for (auto const chr : value) {
+			result ^= static_cast<std::uint8_t>(chr);
+			result *= 16777619u;
+		}
+		return result;
+	}
+
+	std::optional<std::size_t> find(std::string_view value) const noexcept
+	{
+		if (slots.empty()) return {};
+
+		auto const index = slots[hash(value, seed) & (slots.size() - 1)];
+		if (index == empty_slot || values[index] != value) return {};
+		return index;
+	}
+};
+
+// Builds the perfect hash table of an enum parameter at compile time, by
+// trying seeds until none of the values collide:
+//  constexpr enum_values patterns({"static", "slow", "fast"});
+//  ... .type_info = {.enum_ = patterns.typeinfo()} ...
+template <std::size_t N> class enum_values
+{
+  public:
+	static_assert(N > 0 && N < enum_typeinfo::empty_slot);
+
+	// Twice as many slots as values keeps the seed search short
+	static constexpr std::size_t slot_count = std::bit_ceil(N * 2);
+
+	consteval enum_values(std::string_view const (&values)[N])
+	{
+		for (std::size_t i = 0; i < N; ++i) {
+			for (std::size_t j = 0; j < i; ++j)
+				if (values[i] == values[j])
+					throw std::logic_error("Duplicate enum value");
+			m_values[i] = values[i];
+		}
+
+		while (!try_seed())
+			++m_seed;
+	}
+
+	constexpr enum_typeinfo typeinfo() const noexcept
+	{
+		return {.values = m_values, .slots = m_slots, .seed = m_seed};
+	}
+
+  private:
+	constexpr bool try_seed() noexcept
+	{
+		m_slots.fill(enum_typeinfo::empty_slot);
+
+		for (std::size_t i = 0; i < N; ++i) {
+			auto& slot = m_slots[enum_typeinfo::hash(m_values[i], m_seed) &
+			                     (slot_count - 1)];
+			if (slot != enum_typeinfo::empty_slot) return false;
+			slot = i;
+		}
+
+		return true;
+	}
+
+	std::array<std::string_view, N>      m_values{};
+	std::array<std::uint8_t, slot_count> m_slots{};
+	std::uint32_t                        m_seed = 0;
+};
+
 struct parameter {
 	enum type {
 		uint,
 		string,
 		rgb_color,
 		bool_,
+		enum_,
 	};
 
 	struct uint_typeinfo {
@@ -31,28 +148,110 @@ struct parameter {
 
 	union {
 		uint_typeinfo uint;
+		enum_typeinfo enum_;
 	} type_info = {};
 
-	std::string name;
-	std::string description;
+	std::string_view name;
+	std::string_view description;
+
+	// Converts the input to this parameter's type, throwing if it isn't
+	// valid (wrong format, out of range, ...)
+	argument parse(std::string_view input) const;
+
+	// Throws if the value doesn't have this parameter's type, or isn't valid
+	void validate(argument const& value) const;
 
 	static std::string const type_to_string(enum type const&) noexcept;
 };
 
+// The arguments given to an action, already checked against its parameters
+class arguments
+{
+  public:
+	void push_back(argument const& value) { m_values.push_back(value); }
+
+	std::size_t size() const noexcept { return m_values.size(); }
+
+	argument const& operator[](std::size_t i) const noexcept
+	{
+		return m_values[i];
+	}
+
+	std::uint32_t uint(std::size_t i) const
+	{
+		return std::get<std::uint32_t>(m_values[i]);
+	}
+	bool bool_(std::size_t i) const { return std::get<bool>(m_values[i]); }
+	rgb const& rgb_color(std::size_t i) const
+	{
+		return std::get<rgb>(m_values[i]);
+	}
+	std::string_view string(std::size_t i) const
+	{
+		return std::get<std::string_view>(m_values[i]);
+	}
+	// Index of the value in the parameter's list of values
+	std::size_t enum_(std::size_t i) const
+	{
+		return std::get<enum_value>(m_values[i]).index;
+	}
+
+  private:
+	utils::small_vector<argument, 8> m_values;
+};
+
+// Renders a driver's settings, one CSV line per setting:
+//  <name>,<value>[,<value>...]
+// Values are written the way action parameters of the same type are parsed.
+class state_writer
+{
+  public:
+	void uint(std::string_view name, std::uint32_t value);
+	void bool_(std::string_view name, bool value);
+	void rgb_color(std::string_view name, rgb const& color);
+	void string(std::string_view name, std::string_view value);
+	void uint_list(std::string_view               name,
+	               std::span<std::uint16_t const> values);
+
+	std::string const& str() const noexcept { return m_output; }
+
+  private:
+	std::string m_output;
+};
+
+class driver;
+
+// What a driver can do. Actions only describe the driver type, they are
+// stored in a static table per driver class, shared by all its instances.
 struct action {
-	std::string            name;
-	std::string            description;
-	std::vector<parameter> parameters;
+	// How the action is referred to by clients
+	std::string_view id;
 
-	typedef std::function<void(std::vector<std::string> const&)> handler;
+	std::string_view           name;
+	std::string_view           description;
+	std::span<parameter const> parameters = {};
+
+	// Called with the driver instance the action is run on
+	typedef delivery (*handler)(driver&, arguments const&);
+	handler run = nullptr;
+
+	// Parses and validates the inputs against the parameters
+	arguments parse_arguments(std::span<std::string_view const> inputs) const;
+
+	// Checks already-typed arguments against the parameters
+	void validate_arguments(arguments const&) const;
 };
 
+// Drivers are cheap to create: the device isn't opened, and the config isn't
+// loaded, until the driver is first used (see initialize()). What describes
+// the driver type (name, actions, ...) is static, and doesn't need either.
 class driver
 {
   public:
 	driver(std::shared_ptr<usb::device>    dev,
 	       std::shared_ptr<config_manager> config)
 	    : m_device(dev), m_config_manager(config){};
+	virtual ~driver() = default;
 
 	static bool is_compatible(usb::device*) { return false; }
 
@@ -60,14 +259,61 @@ class driver
 
 	virtual const std::string name() const noexcept = 0;
 
-	const std::unordered_map<std::string, action const>& get_actions()
+	// The driver type's action table. An action's index in it identifies
+	// it, as long as the daemon runs.
+	virtual std::span<action const> get_actions() const noexcept = 0;
+
+	// Opens the device, loads the config, and starts reading events. Only
+	// done once, the first time it succeeds, so it's cheap to call before
+	// every use. Actions and get_state() call it themselves, but it must be
+	// called before using a capability.
+	void initialize();
+
+	// Index of an action in get_actions(). The action can be given by its
+	// id, or directly by its index, as a number.
+	std::optional<std::size_t> find_action(
+	    std::string_view id_or_index) const noexcept;
+
+	// Parses the parameters, and runs the action with them
+	delivery run_action(std::size_t                       action_index,
+	                    std::span<std::string_view const> parameters);
+
+	// Runs the action with typed arguments, skipping string parsing. They
+	// are still validated.
+	delivery run_action(std::size_t action_index, arguments const& args);
+
+	// The driver's settings, as rendered by write_state(). They're only
+	// rendered again after they change, so this is cheap to call often.
+	std::shared_ptr<std::string const> get_state();
+
+	// Wireless devices can't be reached while they sleep. Commands sent to
+	// them are queued in the meantime, and sent when they wake up. Whether a
+	// given command was queued is told by what runs it (see delivery), this
+	// may have changed since.
+	virtual bool is_asleep() const noexcept { return false; }
+
+	// Where the device reports events (battery level, DPI changes, ...), if it
+	// does.
+	virtual std::optional<drivers::event_source> get_event_source()
 	    const noexcept
 	{
-		return m_actions;
+		return {};
 	}
 
-	void run_action(std::string const&              action_id,
-	                std::vector<std::string> const& parameters);
+	// Actions and capabilities change the settings (and talk to the device)
+	// from whatever thread uses them, while get_state() reads them. Hold this
+	// while using a capability, actions and get_state() take it themselves.
+	[[nodiscard]] std::unique_lock<std::mutex> lock() const
+	{
+		return std::unique_lock(m_mutex);
+	}
+
+	event_stream& events() noexcept { return m_events; }
+
+	std::shared_ptr<usb::device> const& get_device() const noexcept
+	{
+		return m_device;
+	}
 
   protected:
 	virtual nlohmann::json serialize_current_config() const noexcept      = 0;
@@ -77,23 +323,51 @@ class driver
 	//       content. Should there be a "device initialization" phase that sends
 	//       over the config stored on disk to the device?
 
+	virtual void write_state(state_writer&) const = 0;
+
+	// Every setting change goes through here, so this is also where the
+	// rendered state is invalidated. Called with lock() held.
 	void save_config() const
 	{
+		m_state.reset();
 		m_config_manager->update_config(config_id(),
 		                                serialize_current_config());
 	}
 
-	void register_action(std::string const& id,
-	                     action const&      the_action,
-	                     action::handler const&);
-
-	virtual void create_actions() noexcept = 0;
-
 	std::shared_ptr<usb::device>    m_device;
 	std::shared_ptr<config_manager> m_config_manager;
 
-	std::unordered_map<std::string, action const>    m_actions;
-	std::unordered_map<std::string, action::handler> m_action_handlers;
+	event_stream m_events;
+	// Declared after m_events, so it stops before the stream is destroyed
+	std::unique_ptr<usb::interrupt_reader> m_event_reader;
+
+  private:
+	// Runs an action whose arguments were checked, and times it
+	delivery run(std::size_t action_index, arguments const& args);
+
+	// Listens for events from the device, if it has an event source. The
+	// device must be opened.
+	void start_event_reader();
+
+	std::once_flag m_initialized;
+
+	// How long each action of get_actions() takes, found in the metrics
+	// registry once, on initialize()
+	std::vector<metrics::histogram*> m_action_durations;
+
+	mutable std::mutex m_mutex;
+
+	// Guarded by m_mutex, like the settings it's rendered from
+	mutable std::shared_ptr<std::string const> m_state;
 };
 
+// Lets an action table point at a member function of a driver type:
+//  .run = bind_handler<my_driver, &my_driver::my_action_handler>
+template <typename driver_type,
+          delivery (driver_type::*member_handler)(arguments const&)>
+delivery bind_handler(driver& target, arguments const& args)
+{
+	return (static_cast<driver_type&>(target).*member_handler)(args);
+}
+
 } // namespace drivers
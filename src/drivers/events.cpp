@@ -0,0 +1,63 @@
+#include "drivers/events.hpp"
+
+namespace drivers
+{
+
+std::string const device_event::type_to_string(enum type const& t) noexcept
+{
+	switch (t) {
+	case battery:
+		return "battery";
+	case dpi_profile:
+		return "dpi_profile";
+	case awake:
+		return "awake";
+	case asleep:
+		return "asleep";
+	}
+	return "unknown";
+}
+
+std::string const device_event::stringify() const noexcept
+{
+	switch (type) {
+	case battery:
+		return type_to_string(type) + ',' + std::to_string(value) + ',' +
+		       (charging ? "charging" : "discharging");
+	case dpi_profile:
+		return type_to_string(type) + ',' + std::to_string(value);
+	case awake:
+	case asleep:
+		return type_to_string(type);
+	}
+	return "unknown";
+}
+
+std::shared_ptr<void> event_stream::subscribe(listener const& new_listener)
+{
+	std::lock_guard lock(m_listeners->mutex);
+
+	auto const position =
+	    m_listeners->list.insert(m_listeners->list.end(), new_listener);
+
+	// The subscription doesn't hold anything, it's only there to unregister
+	// the listener when it gets destroyed
+	std::weak_ptr<listeners> weak_listeners = m_listeners;
+	return std::shared_ptr<void>(nullptr, [weak_listeners, position](void*) {
+		auto const listeners = weak_listeners.lock();
+		if (!listeners) return;
+
+		std::lock_guard lock(listeners->mutex);
+		listeners->list.erase(position);
+	});
+}
+
+void event_stream::publish(device_event const& event) const
+{
+	std::lock_guard lock(m_listeners->mutex);
+
+	for (auto const& current_listener : m_listeners->list)
+		current_listener(event);
+}
+
+} // namespace drivers
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace drivers
+{
+
+// Something that happened on the device, reported by the device itself, or
+// noticed by its driver (ex. a wireless device not answering anymore)
+struct device_event {
+	enum type {
+		battery,     // value: battery percentage
+		dpi_profile, // value: new active DPI profile (from 1)
+		awake,
+		asleep,
+	};
+
+	type          type;
+	std::uint32_t value    = 0;
+	bool          charging = false; // Only for battery events
+
+	static std::string const type_to_string(enum type const&) noexcept;
+
+	// CSV representation, as sent to socket clients
+	std::string const stringify() const noexcept;
+};
+
+// Turns a raw report from the device into an event. Returns nothing for
+// reports that aren't events (or that we don't understand yet).
+typedef std::optional<device_event> (*event_decoder)(
+    std::span<std::uint8_t const> report);
+
+// Where a device sends its events, and how to decode them
+struct event_source {
+	std::uint8_t  interface;
+	event_decoder decode;
+};
+
+// Dispatches the events of a device to everyone interested
+class event_stream
+{
+  public:
+	typedef std::function<void(device_event const&)> listener;
+
+	// The listener is called until the returned subscription is destroyed.
+	// Listeners are called from the libusb event thread, and must be quick.
+	std::shared_ptr<void> subscribe(listener const&);
+
+	void publish(device_event const&) const;
+
+  private:
+	struct listeners {
+		std::mutex          mutex;
+		std::list<listener> list;
+	};
+
+	// Shared with the subscriptions, so they can outlive the stream
+	std::shared_ptr<listeners> m_listeners = std::make_shared<listeners>();
+};
+
+} // namespace drivers
@@ -4,9 +4,8 @@
 #include "drivers/steelseries/apex_100.hpp"
 #include "drivers/steelseries/rival_3_wireless.hpp"
 #include "usb/device.hpp"
-#include "utils.hpp"
 #include <memory>
-#include <stdexcept>
+#include <mutex>
 
 namespace drivers
 {
@@ -25,19 +24,25 @@ std::optional<std::shared_ptr<driver>> manager::create_driver_if_available(
 	return {};
 }
 
-identifiable_driver_map manager::create_drivers_for_available_devices() const
+identifiable_driver_map manager::create_drivers_for_available_devices()
 {
+	std::lock_guard lock(m_mutex);
+
 	identifiable_driver_map map = {};
 
 	for (auto const& [identifier, device] : m_device_manager.devices()) {
-		auto const& new_driver = create_driver_if_available(device);
-		if (new_driver.has_value()) {
-			device->open(); // Make sure the device is opened so we can run
-			                // actions on it
-			map[identifier] = new_driver.value();
+		if (m_drivers.contains(identifier) &&
+		    m_drivers.at(identifier)->get_device() == device) {
+			map[identifier] = m_drivers.at(identifier);
+			continue;
 		}
+
+		// The device is only opened when the driver is first used
+		auto const& new_driver = create_driver_if_available(device);
+		if (new_driver.has_value()) map[identifier] = new_driver.value();
 	}
 
+	m_drivers = map;
 	return map;
 }
 
@@ -6,6 +6,7 @@
 #include "usb/device_manager.hpp"
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
 #include <utility>
@@ -28,7 +29,16 @@ class manager
 	std::optional<std::shared_ptr<driver>> create_driver_if_available(
 	    std::shared_ptr<usb::device> device) const;
 
-	identifiable_driver_map create_drivers_for_available_devices() const;
+	// Drivers of devices that were already there are kept as is, so their
+	// state (event readers, subscriptions, ...) survives hotplugs. Safe to
+	// call from any thread.
+	identifiable_driver_map create_drivers_for_available_devices();
+
+	void on_config_updated(
+	    std::function<void(std::string const& config_id)> callback) noexcept
+	{
+		m_config_manager->set_update_listener(callback);
+	}
 
 	void start_hotplug_support(
 	    std::function<void(identifiable_driver_map& new_driver_list)>
@@ -37,6 +47,10 @@ class manager
   private:
 	usb::device_manager&            m_device_manager;
 	std::shared_ptr<config_manager> m_config_manager;
+
+	// Drivers are created from both the hotplug thread and the clients'
+	std::mutex              m_mutex;
+	identifiable_driver_map m_drivers;
 };
 
 } // namespace drivers
@@ -1,8 +1,11 @@
 #include "drivers/steelseries/aerox_3_wireless.hpp"
 #include "drivers/driver.hpp"
+#include "drivers/steelseries/protocol.hpp"
+#include "drivers/steelseries/wireless_link.hpp"
 #include "steelseries.hpp"
 #include "usb/device.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <iostream>
@@ -24,287 +27,385 @@ bool aerox_3_wireless::is_compatible(std::shared_ptr<usb::device> dev)
 	return false;
 }
 
-void aerox_3_wireless::create_actions() noexcept
+namespace
 {
-#define CREATE_ACTION_HANDLER(action_name)                                     \
-	auto action_name##_handler = [this](                                       \
-	    std::vector<std::string> const& parameters)
-
-#define REGISTER_ACTION(action_name)                                           \
-	register_action(#action_name, action_name, action_name##_handler)
-
-#define CHECK_PARAMS_SIZE(minimum_size, action_name)                           \
-	if (parameters.size() < minimum_size)                                      \
-		throw std::runtime_error("Missing arguements for " #action_name);
-
-	action dpi_profile{
-	    .name        = "Switch to DPI Profile",
-	    .description = "Set the current DPI profile",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 1, .max = 5}},
-	         .name        = "profile",
-	         .description = "The DPI profile to switch to",
-        }},
-	};
-
-	CREATE_ACTION_HANDLER(dpi_profile)
-	{
-		CHECK_PARAMS_SIZE(1, dpi_profile);
-
-		std::uint8_t profile =
-		    utils::stoi_safe(parameters[0], {.min = 1, .max = 5}, "Profile");
-
-		m_config.active_dpi_profile = profile;
-		set_dpi(profile, m_config.dpi_profiles);
-		save_config();
-	};
-
-	REGISTER_ACTION(dpi_profile);
-
-	action define_dpi_profile{
-	    .name        = "Define DPI profile",
-	    .description = "Set the DPI value of a profile",
- // Clang doesn't like this for some reason :/
-  // clang-format off
-	    .parameters  = {
-			{
-				.type        = parameter::type::uint,
-				.type_info   = {.uint = {.min = 1, .max = 5}},
-				.name        = "profile",
-				.description = "The profile to update",
-			},
-			{
-				.type        = parameter::type::uint,
-				.type_info   = {.uint = {.min = 100, .max = 18'000}},
-				.name        = "dpi",
-				.description = "The DPI to set the profile to",
-			},
-		},
-  // clang-format on
-	};
-
-	CREATE_ACTION_HANDLER(define_dpi_profile)
-	{
-		CHECK_PARAMS_SIZE(2, define_dpi_profile);
 
-		std::uint8_t profile = utils::stoi_safe(
-		    parameters[0], {.min = 1, .max = 5}, "DPI Profile");
-		std::uint16_t value = utils::stoi_safe(
-		    parameters[1], {.min = 100, .max = 18000}, "DPI Value");
-
-		m_config.dpi_profiles[profile - 1] = value;
-		set_dpi(m_config.active_dpi_profile, m_config.dpi_profiles);
-		save_config();
-	};
-
-	REGISTER_ACTION(define_dpi_profile);
-
-	action lighting_color{
-	    .name        = "Light color",
-	    .description = "Set the color of the lights",
- // Clang doesn't like this for some reason :/
-  // clang-format off
-	    .parameters = {
-			{
-				.type        = parameter::type::uint,
-				.type_info   = {.uint = {.min = 1, .max = 3}},
-				.name        = "zone",
-				.description = "The zone to edit",
-			},
-			{
-				 .type        = parameter::type::rgb_color,
-				 .name        = "color",
-				 .description = "The RGB color to change it to (ex. 'FFFFFF')",
-			},
-		},
-  // clang-format on
-	};
+// Everything goes to interface 3
+constexpr protocol::field set_dpi_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x6d},
+    // Number of profiles
+    {.type = protocol::field::u8, .offset = 1},
+    // The active profile. It's from 1 to 5 to be human readable, but the
+    // device wants it to be 0 to 4.
+    {.type = protocol::field::u8, .offset = 2, .adjust = -1},
+    // The DPI of each profile
+    {.type = protocol::field::dpi, .offset = 3, .count = 5, .stride = 1},
+};
+constexpr protocol::packet set_dpi_packet{
+    .interface = 3,
+    .size      = 8,
+    .fields    = set_dpi_fields,
+};
+
+constexpr protocol::field set_lighting_color_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x61},
+    {.type = protocol::field::constant, .offset = 1, .value = 0x01},
+    // Zone, from 1 to 3 for humans, 0 to 2 for the device
+    {.type = protocol::field::u8, .offset = 2, .adjust = -1},
+    // RGB
+    {.type = protocol::field::u8, .offset = 3, .count = 3, .stride = 1},
+};
+constexpr protocol::packet set_lighting_color_packet{
+    .interface = 3,
+    .size       = 6,
+    .fields     = set_lighting_color_fields,
+    .key_values = 1, // Zones are set separately
+};
+
+constexpr protocol::field set_poll_interval_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x6b},
+    // Interval, from 1 to 4 for humans, 0 to 3 for the device
+    {.type = protocol::field::u8, .offset = 1, .adjust = -1},
+};
+constexpr protocol::packet set_poll_interval_packet{
+    .interface = 3,
+    .size      = 2,
+    .fields    = set_poll_interval_fields,
+};
+
+constexpr protocol::field set_sleep_timeout_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x69},
+    {.type = protocol::field::u32le, .offset = 1},
+};
+constexpr protocol::packet set_sleep_timeout_packet{
+    .interface = 3,
+    .size      = 5,
+    .fields    = set_sleep_timeout_fields,
+};
+
+constexpr protocol::field save_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x51},
+};
+constexpr protocol::packet save_packet{
+    .interface = 3,
+    .size      = 1,
+    .fields    = save_fields,
+};
+
+// The answer comes as a 0xd2 report on the event interface
+constexpr protocol::field request_battery_status_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0xd2},
+};
+constexpr protocol::packet request_battery_status_packet{
+    .interface = 3,
+    .size      = 1,
+    .fields    = request_battery_status_fields,
+};
+
+constexpr parameter dpi_profile_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 5}},
+        .name        = "profile",
+        .description = "The DPI profile to switch to",
+    },
+};
+
+constexpr parameter define_dpi_profile_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 5}},
+        .name        = "profile",
+        .description = "The profile to update",
+    },
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 100, .max = 18'000}},
+        .name        = "dpi",
+        .description = "The DPI to set the profile to",
+    },
+};
+
+constexpr parameter lighting_color_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 3}},
+        .name        = "zone",
+        .description = "The zone to edit",
+    },
+    {
+        .type        = parameter::type::rgb_color,
+        .name        = "color",
+        .description = "The RGB color to change it to (ex. 'FFFFFF')",
+    },
+};
+
+constexpr parameter polling_interval_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 4}},
+        .name        = "interval",
+        .description = "Interval between polls (1 -> 1000Hz, 4 -> 250Hz)",
+    },
+};
+
+constexpr parameter sleep_timeout_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 0, .max = 1'200'000}},
+        .name        = "timeout",
+        .description = "The time in second before the mouse goes to sleep",
+    },
+};
+
+} // namespace
+
+#define HANDLER(action_name)                                                   \
+	bind_handler<aerox_3_wireless, &aerox_3_wireless::action_name##_handler>
+
+constexpr action aerox_3_wireless::actions[] = {
+    {
+        .id          = "dpi_profile",
+        .name        = "Switch to DPI Profile",
+        .description = "Set the current DPI profile",
+        .parameters  = dpi_profile_parameters,
+        .run         = HANDLER(dpi_profile),
+    },
+    {
+        .id          = "define_dpi_profile",
+        .name        = "Define DPI profile",
+        .description = "Set the DPI value of a profile",
+        .parameters  = define_dpi_profile_parameters,
+        .run         = HANDLER(define_dpi_profile),
+    },
+    {
+        .id          = "lighting_color",
+        .name        = "Light color",
+        .description = "Set the color of the lights",
+        .parameters  = lighting_color_parameters,
+        .run         = HANDLER(lighting_color),
+    },
+    {
+        .id          = "polling_interval",
+        .name        = "Polling interval",
+        .description = "Sets the polling interval",
+        .parameters  = polling_interval_parameters,
+        .run         = HANDLER(polling_interval),
+    },
+    {
+        .id          = "sleep_timeout",
+        .name        = "Sleep timeout",
+        .description = "Sets the sleep timeout, in seconds",
+        .parameters  = sleep_timeout_parameters,
+        .run         = HANDLER(sleep_timeout),
+    },
+    {
+        .id          = "save",
+        .name        = "Save",
+        .description = "Save to onboard memory",
+        .run         = HANDLER(save),
+    },
+};
+
+#undef HANDLER
+
+std::span<action const> aerox_3_wireless::get_actions() const noexcept
+{
+	return actions;
+}
 
-	CREATE_ACTION_HANDLER(lighting_color)
-	{
-		CHECK_PARAMS_SIZE(2, lighting_color);
+delivery aerox_3_wireless::dpi_profile_handler(arguments const& args)
+{
+	return apply_active_dpi_profile(static_cast<std::uint8_t>(args.uint(0)));
+}
 
-		std::uint8_t zone =
-		    utils::stoi_safe(parameters[0], {.min = 1, .max = 3}, "Color zone");
+delivery aerox_3_wireless::define_dpi_profile_handler(arguments const& args)
+{
+	auto const profile = args.uint(0);
+	auto const value   = static_cast<std::uint16_t>(args.uint(1));
 
-		// TODO Error checking...
-		auto         color = parameters[1];
-		std::uint8_t r     = std::stoi(color.substr(0, 2), nullptr, 16);
-		std::uint8_t g     = std::stoi(color.substr(2, 2), nullptr, 16);
-		std::uint8_t b     = std::stoi(color.substr(4, 2), nullptr, 16);
+	m_config.dpi_profiles[profile - 1] = value;
 
-		m_config.lighting_colors = {r, g, b};
-		set_lighting_color(zone, {r, g, b});
-		save_config();
-	};
+	auto const result =
+	    set_dpi(m_config.active_dpi_profile, m_config.dpi_profiles);
+	save_config();
+	return result;
+}
 
-	REGISTER_ACTION(lighting_color);
-
-	action polling_interval{
-	    .name        = "Polling interval",
-	    .description = "Sets the polling interval",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 1, .max = 4}},
-	         .name        = "interval",
-	         .description = "Interval between polls (1 -> 1000Hz, 4 -> 250Hz)",
-        }},
-	};
+delivery aerox_3_wireless::lighting_color_handler(arguments const& args)
+{
+	auto const  zone  = static_cast<std::uint8_t>(args.uint(0));
+	auto const& color = args.rgb_color(1);
 
-	CREATE_ACTION_HANDLER(polling_interval)
-	{
-		CHECK_PARAMS_SIZE(1, polling_interval);
+	m_config.lighting_colors = color;
+	auto const result        = set_lighting_color(zone, color);
+	save_config();
+	return result;
+}
 
-		std::uint8_t interval =
-		    utils::stoi_safe(parameters[0], {.min = 1, .max = 4}, "Interval");
+delivery aerox_3_wireless::polling_interval_handler(arguments const& args)
+{
+	return apply_poll_interval(static_cast<std::uint8_t>(args.uint(0)));
+}
 
-		m_config.poll_interval = interval;
-		set_poll_interval(interval);
-		save_config();
-	};
+delivery aerox_3_wireless::sleep_timeout_handler(arguments const& args)
+{
+	return apply_sleep_timeout(args.uint(0));
+}
 
-	REGISTER_ACTION(polling_interval);
-
-	action sleep_timeout{
-	    .name        = "Sleep timeout",
-	    .description = "Sets the sleep timeout, in seconds",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 0, .max = 1'200'000}},
-	         .name        = "timeout",
-	         .description = "The time in second before the mouse goes to sleep",
-        }},
-	};
+delivery aerox_3_wireless::save_handler(arguments const&)
+{
+	return save_to_onboard_memory();
+}
 
-	CREATE_ACTION_HANDLER(sleep_timeout)
-	{
-		CHECK_PARAMS_SIZE(1, sleep_timeout);
+delivery aerox_3_wireless::apply_dpi_profiles(
+    std::span<std::uint16_t const> dpis)
+{
+	if (dpis.size() > m_config.dpi_profiles.size())
+		throw std::runtime_error("Too many DPI profiles, must be <5");
+	for (auto const dpi : dpis)
+		utils::ensure_range(dpi, 100, 18'000, "DPI");
+
+	std::copy(dpis.begin(), dpis.end(), m_config.dpi_profiles.begin());
+	auto const result =
+	    set_dpi(m_config.active_dpi_profile, m_config.dpi_profiles);
+	save_config();
+	return result;
+}
 
-		std::uint32_t timeout = utils::stoi_safe(
-		    parameters[0], {.min = 0, .max = 1'200'000}, "Timeout");
+delivery aerox_3_wireless::apply_active_dpi_profile(std::uint8_t profile)
+{
+	utils::ensure_range(profile, 1, 5, "Profile ID");
 
-		m_config.sleep_timeout = timeout;
-		set_sleep_timeout(timeout);
-		save_config();
-	};
+	m_config.active_dpi_profile = profile;
+	auto const result           = set_dpi(profile, m_config.dpi_profiles);
+	save_config();
+	return result;
+}
 
-	REGISTER_ACTION(sleep_timeout);
+delivery aerox_3_wireless::apply_lighting_color(rgb const& color)
+{
+	// Only sent if every zone was
+	auto result = sent;
+	for (std::uint8_t zone = 1; zone <= lighting_zone_count(); ++zone)
+		if (set_lighting_color(zone, color) == queued) result = queued;
+
+	m_config.lighting_colors = color;
+	save_config();
+	return result;
+}
 
-	action save{
-	    .name        = "Save",
-	    .description = "Save to onboard memory",
-	    .parameters  = {},
-	};
+delivery aerox_3_wireless::apply_poll_interval(std::uint8_t interval_ms)
+{
+	m_config.poll_interval = interval_ms;
+	auto const result      = set_poll_interval(interval_ms);
+	save_config();
+	return result;
+}
 
-	CREATE_ACTION_HANDLER(save)
-	{
-		(void)parameters;
-		this->save();
-		save_config();
-	};
+delivery aerox_3_wireless::apply_sleep_timeout(std::uint32_t seconds)
+{
+	utils::ensure_range(seconds, 0u, 1'200'000u, "Timeout");
 
-	REGISTER_ACTION(save);
+	m_config.sleep_timeout = seconds;
+	auto const result      = set_sleep_timeout(seconds);
+	save_config();
+	return result;
+}
 
-#undef CREATE_ACTION_HANDLER
-#undef REGISTER_ACTION
-#undef CHECK_PARAMS_SIZE
+delivery aerox_3_wireless::save_to_onboard_memory()
+{
+	auto const result = save();
+	save_config();
+	return result;
 }
 
-void aerox_3_wireless::set_dpi(std::uint8_t               active_profile_id,
-                               std::vector<std::uint16_t> dpi_profiles) const
+delivery aerox_3_wireless::set_dpi(
+    std::uint8_t               active_profile_id,
+    std::vector<std::uint16_t> dpi_profiles) const
 {
 	utils::ensure_range(active_profile_id, 1, 5, "Profile ID");
-	--active_profile_id; // The profile ID is from 1 to 5 to be human
-	                     // readable, but the driver wants it to be 0 to 4,
-	                     // so this converts it.
 
 	if (dpi_profiles.size() > 5)
 		throw std::runtime_error("Too many DPI profiles, must be <5");
 
-	std::vector<std::uint8_t> data = {
-	    0x6d, // Packet ID
-	    (std::uint8_t)
-	        dpi_profiles.size(), // It's safe to cast to u8 because we check
-	                             // the value at the start of the function
+	// Profiles we don't have are sent as 0
+	std::array<std::uint32_t, 7> values = {
+	    static_cast<std::uint32_t>(dpi_profiles.size()),
 	    active_profile_id,
-	    // Those are the DPI values for each profile. We will set them right
-	    // after
-	    // clang-format off
-	    0, 0, 0, 0, 0,
-	    // clang-format on
-	};
-
-	// The driver takes a DPI value between 0 and 0xd6, which is equivalent
-	// to the 100->18000 DPI we can set in the software. This function
-	// converts from the 100-18000 human-readable value to the driver value
-	// for 0 to 0xd6
-	auto to_driver_dpi = [](std::uint16_t human_dpi) -> std::uint8_t {
-		return utils::scale((float)human_dpi, 100, 18'000, 0, 0xd6);
 	};
+	std::copy(dpi_profiles.begin(), dpi_profiles.end(), values.begin() + 2);
 
-	for (std::size_t i = 0; i < dpi_profiles.size(); ++i)
-		data[i + 3] /* The DPI profiles start at data[3] */ =
-		    to_driver_dpi(dpi_profiles[i]);
-
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+	return m_link.send(set_dpi_packet, values);
 }
 
-void aerox_3_wireless::set_lighting_color(
+delivery aerox_3_wireless::set_lighting_color(
     std::uint8_t zone, std::array<std::uint8_t, 3> color) const
 {
 	utils::ensure_range(zone, 1, 3, "Zone");
-	--zone; // The zone ID is from 1 to 3 to be human readable, but the
-	        // driver wants it to be 0 to 2, so this converts it.
 
-	std::vector<std::uint8_t> data = {
-	    // clang-format off
-	    0x61, 0x01, // Packet ID
+	std::array<std::uint32_t, 4> const values = {
 	    zone,
-		color[0], color[1], color[2],
-	    // clang-format on
+	    color[0],
+	    color[1],
+	    color[2],
 	};
-
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+	return m_link.send(set_lighting_color_packet, values);
 }
 
-void aerox_3_wireless::set_poll_interval(std::uint8_t interval) const
+delivery aerox_3_wireless::set_poll_interval(std::uint8_t interval) const
 {
 	utils::ensure_range(interval, 1, 4, "Interval");
-	--interval; // The interval is from 1 to 4 to be human readable, but the
-	            // driver wants it to be 0 to 3, so this converts it.
 
-	std::vector<std::uint8_t> data = {
-	    0x6b, // Packet ID
-	    interval,
-	};
+	std::array<std::uint32_t, 1> const values = {interval};
+	return m_link.send(set_poll_interval_packet, values);
+}
 
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+delivery aerox_3_wireless::set_sleep_timeout(
+    std::uint32_t timeout_in_seconds) const
+{
+	std::array<std::uint32_t, 1> const values = {timeout_in_seconds};
+	return m_link.send(set_sleep_timeout_packet, values);
 }
 
-void aerox_3_wireless::set_sleep_timeout(std::uint32_t timeout_in_seconds) const
+delivery aerox_3_wireless::save() const
 {
-	std::vector<std::uint8_t> data = {
-	    0x69, // Nice packet ID
-	    // Timeout value (in reverse byte order to match what the driver
-	    // expects).
-	    // This uses some bit manipulation magic that I don't fully
-	    // understand, but it works, and the code looks nice, so I'm fine
-	    // with it
-	    static_cast<std::uint8_t>((timeout_in_seconds & 0x000000ff) >> 0),
-	    static_cast<std::uint8_t>((timeout_in_seconds & 0x0000ff00) >> 8),
-	    static_cast<std::uint8_t>((timeout_in_seconds & 0x00ff0000) >> 16),
-	    static_cast<std::uint8_t>((timeout_in_seconds & 0xff000000) >> 24),
+	return m_link.send(save_packet);
+}
 
-	};
+void aerox_3_wireless::request_battery_status() const
+{
+	m_link.send(request_battery_status_packet);
+}
 
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+std::optional<device_event> aerox_3_wireless::decode_event(
+    std::span<std::uint8_t const> report)
+{
+	if (report.size() < 2) return {};
+
+	switch (report[0]) {
+	case 0xd2: // Battery status, sent in response to a 0xd2 request
+		// The top bit is set while charging, the rest is the percentage
+		return device_event{
+		    .type     = device_event::battery,
+		    .value    = std::min<std::uint32_t>(report[1] & 0x7f, 100),
+		    .charging = (report[1] & 0x80) != 0,
+		};
+	// TODO: Captures also show 0x40 (the receiver lost/found the mouse) and
+	//       0x6e (DPI button) reports, decode them once their layout is
+	//       confirmed
+	}
+
+	return {};
 }
 
-void aerox_3_wireless::save() const
+void aerox_3_wireless::write_state(state_writer& writer) const
 {
-	// 0x51 is the save command ID
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, {0x51}, 1000);
+	writer.uint("active_dpi_profile", m_config.active_dpi_profile);
+	writer.uint_list("dpi_profiles", m_config.dpi_profiles);
+	writer.rgb_color("lighting_colors", m_config.lighting_colors);
+	writer.uint("poll_interval", m_config.poll_interval);
+	writer.uint("sleep_timeout", m_config.sleep_timeout);
 }
 
 nlohmann::json aerox_3_wireless::serialize_current_config() const noexcept
@@ -1,6 +1,11 @@
 #pragma once
+#include "drivers/capabilities.hpp"
 #include "drivers/driver.hpp"
+#include "drivers/events.hpp"
+#include "drivers/steelseries/wireless_link.hpp"
 #include "usb/device.hpp"
+#include <optional>
+#include <span>
 #include <array>
 #include <cstdint>
 #include <vector>
@@ -10,15 +15,19 @@ namespace drivers
 namespace steelseries
 {
 
-class aerox_3_wireless final : public driver
+class aerox_3_wireless final : public driver,
+                               public capabilities::dpi_table,
+                               public capabilities::zone_lighting,
+                               public capabilities::poll_rate,
+                               public capabilities::sleep_timeout,
+                               public capabilities::onboard_save,
+                               public capabilities::battery_status
 {
   public:
 	aerox_3_wireless(std::shared_ptr<usb::device>    dev,
 	                 std::shared_ptr<config_manager> config)
-	    : driver(dev, config)
+	    : driver(dev, config), m_link(dev, m_events)
 	{
-		deserialize_config(config->get_device_config(config_id()));
-		create_actions();
 	}
 
 	static bool is_compatible(std::shared_ptr<usb::device>);
@@ -33,22 +42,59 @@ class aerox_3_wireless final : public driver
 		return "SteelSeries Aerox 3 Wireless";
 	};
 
-	void set_dpi(std::uint8_t               active_profile_id,
-	             std::vector<std::uint16_t> dpi_profiles) const;
-	void set_lighting_color(std::uint8_t                zone,
-	                        std::array<std::uint8_t, 3> color) const;
-	void set_poll_interval(std::uint8_t interval) const;
-	void set_sleep_timeout(std::uint32_t timeout) const;
-	void save() const;
+	std::span<action const> get_actions() const noexcept final;
+
+	delivery set_dpi(std::uint8_t               active_profile_id,
+	                 std::vector<std::uint16_t> dpi_profiles) const;
+	delivery set_lighting_color(std::uint8_t                zone,
+	                            std::array<std::uint8_t, 3> color) const;
+	delivery set_poll_interval(std::uint8_t interval) const;
+	delivery set_sleep_timeout(std::uint32_t timeout) const;
+	delivery save() const;
+
+	std::size_t dpi_profile_count() const noexcept final { return 5; }
+	delivery apply_dpi_profiles(std::span<std::uint16_t const> dpis) final;
+	delivery apply_active_dpi_profile(std::uint8_t profile) final;
+
+	std::size_t lighting_zone_count() const noexcept final { return 3; }
+	void        set_zone_color(std::size_t zone, rgb const& color) const final
+	{
+		set_lighting_color(zone + 1, color);
+	}
+	delivery apply_lighting_color(rgb const& color) final;
+
+	delivery apply_poll_interval(std::uint8_t interval_ms) final;
+	delivery apply_sleep_timeout(std::uint32_t seconds) final;
+	delivery save_to_onboard_memory() final;
+
+	void request_battery_status() const final;
+
+	bool is_asleep() const noexcept final { return !m_link.is_awake(); }
+
+	std::optional<event_source> get_event_source() const noexcept final
+	{
+		return event_source{.interface = 3, .decode = decode_event};
+	}
 
   protected:
+	void write_state(state_writer& writer) const override final;
 	nlohmann::json serialize_current_config() const noexcept override final;
 	void           deserialize_config(
 	              nlohmann::json const& config_on_disk) override final;
 
-	virtual void create_actions() noexcept override final;
-
   private:
+	static action const actions[];
+
+	delivery dpi_profile_handler(arguments const&);
+	delivery define_dpi_profile_handler(arguments const&);
+	delivery lighting_color_handler(arguments const&);
+	delivery polling_interval_handler(arguments const&);
+	delivery sleep_timeout_handler(arguments const&);
+	delivery save_handler(arguments const&);
+
+	static std::optional<device_event> decode_event(
+	    std::span<std::uint8_t const> report);
+
 	struct {
 		std::uint8_t                active_dpi_profile = 1;
 		std::vector<std::uint16_t>  dpi_profiles = {400, 800, 1200, 2400, 3200};
@@ -56,6 +102,9 @@ class aerox_3_wireless final : public driver
 		std::uint8_t                poll_interval   = 1;
 		std::uint32_t               sleep_timeout   = 0;
 	} m_config;
+
+	// Setters only send packets, they don't change the driver's state
+	mutable wireless_link m_link;
 };
 
 } // namespace steelseries
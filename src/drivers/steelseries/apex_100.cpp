@@ -1,6 +1,11 @@
 #include "apex_100.hpp"
+#include "drivers/steelseries/protocol.hpp"
 #include "steelseries.hpp"
 #include "usb/device.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <iterator>
 #include <memory.h>
 #include <string>
 #include <vector>
@@ -18,149 +23,179 @@ bool apex_100::is_compatible(std::shared_ptr<usb::device> dev)
 	return false;
 }
 
-void apex_100::create_actions() noexcept
-{
-	// TODO: Use those macros to create the actions and register them, like in
-	// steelseries::aerox_3_wireless
-#define CREATE_ACTION_HANDLER(action_name)                                     \
-	auto action_name##_handler = [this](                                       \
-	    std::vector<std::string> const& parameters)
-
-#define REGISTER_ACTION(action_name)                                           \
-	register_action(#action_name, action_name, action_name##_handler)
-
-#define CHECK_PARAMS_SIZE(minimum_size, action_name)                           \
-	if (parameters.size() < minimum_size)                                      \
-		throw std::runtime_error("Missing arguements for " #action_name);
-
-	action backlight_luminosity{
-	    .name        = "Backlight luminosity",
-	    .description = "Backlight luminosity",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.max = 100}},
-	         .name        = "luminosity",
-	         .description = "Luminosity percentage",
-        }},
-	};
+namespace
+{
 
-	auto backlight_luminosity_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for backlight_luminosity");
-
-		    std::uint8_t backlight_value;
-		    try {
-			    auto val = std::stoi(parameters[0]);
-			    if (val < 0 || val > 100)
-				    throw std::runtime_error("Invalid luminosity value");
-			    backlight_value = val;
-		    } catch (std::invalid_argument const& e) {
-			    throw std::runtime_error("Luminosity value isn't a number (" +
-			                             parameters[0] + ")");
-		    }
-
-		    m_config.backlight_luminosity = backlight_value;
-		    set_backlight_luminosity(backlight_value);
-		    save_config();
-	    };
-
-	register_action("backlight_luminosity",
-	                backlight_luminosity,
-	                backlight_luminosity_handler);
-
-	action backlight_pattern{
-	    .name        = "Backlight pattern",
-	    .description = "Backlight pattern",
-	    .parameters  = {{
-	         .type = parameter::type::string,
-	         .name = "pattern",
-	         .description =
-                "Pattern to use ('static', 'slow', 'medium', 'fast')",
-        }},
-	};
+// Packets are the command ID, a null byte for reasons, and the value. They all
+// go to interface 1.
+constexpr protocol::field set_backlight_luminosity_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x05},
+    {.type = protocol::field::u8, .offset = 2},
+};
+constexpr protocol::packet set_backlight_luminosity_packet{
+    .interface = 1,
+    .size      = 3,
+    .fields    = set_backlight_luminosity_fields,
+};
+
+constexpr protocol::field set_backlight_pattern_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x07},
+    {.type = protocol::field::u8, .offset = 2},
+};
+constexpr protocol::packet set_backlight_pattern_packet{
+    .interface = 1,
+    .size      = 3,
+    .fields    = set_backlight_pattern_fields,
+};
+
+constexpr protocol::field set_polling_interval_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x04},
+    {.type = protocol::field::u8, .offset = 2},
+};
+constexpr protocol::packet set_polling_interval_packet{
+    .interface = 1,
+    .size      = 3,
+    .fields    = set_polling_interval_fields,
+};
+
+constexpr protocol::field save_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x09},
+};
+constexpr protocol::packet save_packet{
+    .interface = 1,
+    .size      = 1,
+    .fields    = save_fields,
+};
+
+constexpr parameter backlight_luminosity_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.max = 100}},
+        .name        = "luminosity",
+        .description = "Luminosity percentage",
+    },
+};
+
+// In the same order as the values below
+constexpr apex_100::backlight_pattern backlight_patterns[] = {
+    apex_100::backlight_pattern::static_,
+    apex_100::backlight_pattern::slow,
+    apex_100::backlight_pattern::medium,
+    apex_100::backlight_pattern::fast,
+};
+
+constexpr enum_values backlight_pattern_values({
+    "static",
+    "slow",
+    "medium",
+    "fast",
+});
+
+constexpr parameter backlight_pattern_parameters[] = {
+    {
+        .type        = parameter::type::enum_,
+        .type_info   = {.enum_ = backlight_pattern_values.typeinfo()},
+        .name        = "pattern",
+        .description = "Pattern to use",
+    },
+};
+
+constexpr parameter polling_interval_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 4}},
+        .name        = "interval",
+        .description = "Interval between polls, in milliseconds",
+    },
+};
+
+} // namespace
+
+#define HANDLER(action_name)                                                   \
+	bind_handler<apex_100, &apex_100::action_name##_handler>
+
+constexpr action apex_100::actions[] = {
+    {
+        .id          = "backlight_luminosity",
+        .name        = "Backlight luminosity",
+        .description = "Backlight luminosity",
+        .parameters  = backlight_luminosity_parameters,
+        .run         = HANDLER(backlight_luminosity),
+    },
+    {
+        .id          = "backlight_pattern",
+        .name        = "Backlight pattern",
+        .description = "Backlight pattern",
+        .parameters  = backlight_pattern_parameters,
+        .run         = HANDLER(backlight_pattern),
+    },
+    {
+        .id          = "polling_interval",
+        .name        = "Polling interval",
+        .description = "Polling interval",
+        .parameters  = polling_interval_parameters,
+        .run         = HANDLER(polling_interval),
+    },
+    {
+        .id          = "save",
+        .name        = "Save",
+        .description = "Save data to onboard memory",
+        .run         = HANDLER(save),
+    },
+};
+
+#undef HANDLER
+
+std::span<action const> apex_100::get_actions() const noexcept
+{
+	return actions;
+}
 
-	auto backlight_pattern_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for backlight_patterns");
-
-		    auto pattern_string = parameters[0];
-
-		    enum backlight_pattern pattern;
-		    if (pattern_string == "static")
-			    pattern = backlight_pattern::static_;
-		    else if (pattern_string == "slow")
-			    pattern = backlight_pattern::slow;
-		    else if (pattern_string == "medium")
-			    pattern = backlight_pattern::medium;
-		    else if (pattern_string == "fast")
-			    pattern = backlight_pattern::fast;
-		    else
-			    throw std::runtime_error("Invalid backlight pattern");
-
-		    m_config.pattern = pattern;
-		    set_backlight_pattern(pattern);
-		    save_config();
-	    };
-
-	register_action(
-	    "backlight_pattern", backlight_pattern, backlight_pattern_handler);
-
-	action polling_interval{
-	    .name        = "Polling interval",
-	    .description = "Polling interval",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 1, .max = 4}},
-	         .name        = "interval",
-	         .description = "Interval between polls, in milliseconds",
-        }},
-	};
+// The keyboard is wired, whatever is sent reaches it right away
 
-	auto polling_interval_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for polling_interval");
-
-		    std::uint8_t polling_interval;
-		    try {
-			    auto val = std::stoi(parameters[0]);
-			    if (val < 1 || val > 4)
-				    throw std::runtime_error("Invalid polling interval value");
-			    polling_interval = val;
-		    } catch (std::invalid_argument const& e) {
-			    throw std::runtime_error("Polling value isn't a number (" +
-			                             parameters[0] + ")");
-		    }
-
-		    m_config.polling_interval = polling_interval;
-		    set_polling_interval(polling_interval);
-		    save_config();
-	    };
-
-	register_action(
-	    "polling_interval", polling_interval, polling_interval_handler);
-
-	action save{
-	    .name        = "Save",
-	    .description = "Save data to onboard memory",
-	    .parameters  = {},
-	};
+delivery apex_100::backlight_luminosity_handler(arguments const& args)
+{
+	auto const backlight_value = static_cast<std::uint8_t>(args.uint(0));
 
-	auto save_handler = [this](std::vector<std::string> const&) {
-		this->save();
-		save_config();
-	};
+	m_config.backlight_luminosity = backlight_value;
+	set_backlight_luminosity(backlight_value);
+	save_config();
+	return sent;
+}
+
+delivery apex_100::backlight_pattern_handler(arguments const& args)
+{
+	auto const pattern = backlight_patterns[args.enum_(0)];
+
+	m_config.pattern = pattern;
+	set_backlight_pattern(pattern);
+	save_config();
+	return sent;
+}
+
+delivery apex_100::polling_interval_handler(arguments const& args)
+{
+	return apply_poll_interval(static_cast<std::uint8_t>(args.uint(0)));
+}
+
+delivery apex_100::save_handler(arguments const&)
+{
+	return save_to_onboard_memory();
+}
 
-	register_action("save", save, save_handler);
+delivery apex_100::apply_poll_interval(std::uint8_t interval_ms)
+{
+	m_config.polling_interval = interval_ms;
+	set_polling_interval(interval_ms);
+	save_config();
+	return sent;
+}
 
-#undef CREATE_ACTION_HANDLER
-#undef REGISTER_ACTION
-#undef CHECK_PARAMS_SIZE
+delivery apex_100::save_to_onboard_memory()
+{
+	save();
+	save_config();
+	return sent;
 }
 
 void apex_100::set_backlight_luminosity(std::uint8_t luminosity) const
@@ -169,30 +204,15 @@ void apex_100::set_backlight_luminosity(std::uint8_t luminosity) const
 	                      // because it's an unsigned variable.
 		throw std::runtime_error("Luminosity should be between [0-100]");
 
-	// Create a vector for the USB data we're going to send.
-	// We will send 3 bytes.
-	std::vector<std::uint8_t> data(3);
-
-	data[0] = 0x05;       // Command ID
-	data[1] = 0x00;       // Null byte for reasons
-	data[2] = luminosity; // The luminosity value to set
-
-	m_device->control_transfer(0x21, 0x09, 0x0200, 1, data, 1000);
+	std::array<std::uint32_t, 1> const values = {luminosity};
+	protocol::send(*m_device, set_backlight_luminosity_packet, values);
 }
 
 void apex_100::set_backlight_pattern(backlight_pattern pattern) const
 {
-	// Create a vector for the USB data we're going to send.
-	// We will send 3 bytes.
-	std::vector<std::uint8_t> data(3);
-
-	data[0] = 0x07;    // Command ID
-	data[1] = 0x00;    // Null byte for reasons
-	data[2] = pattern; // The pattern to use. The backlight_pattern
-	                   // enum is of type std::uint8_t, so no need to
-	                   // do any convertion
-
-	m_device->control_transfer(0x21, 0x09, 0x0200, 1, data, 1000);
+	// The backlight_pattern enum has the values the device expects
+	std::array<std::uint32_t, 1> const values = {pattern};
+	protocol::send(*m_device, set_backlight_pattern_packet, values);
 }
 
 void apex_100::set_polling_interval(std::uint8_t polling_interval) const
@@ -200,21 +220,29 @@ void apex_100::set_polling_interval(std::uint8_t polling_interval) const
 	if (polling_interval > 4 || polling_interval < 1)
 		throw std::runtime_error("Polling interval should be between [1-4]");
 
-	// Create a vector for the USB data we're going to send.
-	// We will send 3 bytes.
-	std::vector<std::uint8_t> data(3);
-
-	data[0] = 0x04;             // Command ID
-	data[1] = 0x00;             // Null byte for reasons
-	data[2] = polling_interval; // The polling value to set
-
-	m_device->control_transfer(0x21, 0x09, 0x0200, 1, data, 1000);
+	std::array<std::uint32_t, 1> const values = {polling_interval};
+	protocol::send(*m_device, set_polling_interval_packet, values);
 }
 
 void apex_100::save() const
 {
-	// Send a save instruction
-	m_device->control_transfer(0x21, 0x09, 0x0200, 1, {0x09}, 1000);
+	protocol::send(*m_device, save_packet);
+}
+
+void apex_100::write_state(state_writer& writer) const
+{
+	writer.uint("backlight_luminosity", m_config.backlight_luminosity);
+
+	// Written as the backlight_pattern action takes it
+	auto const pattern = std::find(std::begin(backlight_patterns),
+	                               std::end(backlight_patterns),
+	                               m_config.pattern);
+	if (pattern != std::end(backlight_patterns))
+		writer.string("backlight_pattern",
+		              backlight_pattern_values.typeinfo()
+		                  .values[pattern - std::begin(backlight_patterns)]);
+
+	writer.uint("polling_interval", m_config.polling_interval);
 }
 
 nlohmann::json apex_100::serialize_current_config() const noexcept
@@ -1,13 +1,17 @@
 #pragma once
+#include "drivers/capabilities.hpp"
 #include "drivers/driver.hpp"
 #include "usb/device.hpp"
+#include <span>
 
 namespace drivers
 {
 namespace steelseries
 {
 
-class apex_100 final : public driver
+class apex_100 final : public driver,
+                       public capabilities::poll_rate,
+                       public capabilities::onboard_save
 {
   public:
 	enum backlight_pattern : std::uint8_t {
@@ -21,8 +25,6 @@ class apex_100 final : public driver
 	         std::shared_ptr<config_manager> config)
 	    : driver(dev, config)
 	{
-		create_actions();
-		deserialize_config(config->get_device_config(config_id()));
 	}
 
 	static bool is_compatible(std::shared_ptr<usb::device>);
@@ -37,19 +39,30 @@ class apex_100 final : public driver
 		return "SteelSeries Apex 100";
 	};
 
+	std::span<action const> get_actions() const noexcept final;
+
 	void set_backlight_luminosity(std::uint8_t) const;
 	void set_backlight_pattern(backlight_pattern) const;
 	void set_polling_interval(std::uint8_t) const;
 	void save() const;
 
+	delivery apply_poll_interval(std::uint8_t interval_ms) final;
+	delivery save_to_onboard_memory() final;
+
   protected:
+	void write_state(state_writer& writer) const override final;
 	nlohmann::json serialize_current_config() const noexcept override final;
 	void           deserialize_config(
 	              nlohmann::json const& config_on_disk) override final;
 
-	void create_actions() noexcept override final;
-
   private:
+	static action const actions[];
+
+	delivery backlight_luminosity_handler(arguments const&);
+	delivery backlight_pattern_handler(arguments const&);
+	delivery polling_interval_handler(arguments const&);
+	delivery save_handler(arguments const&);
+
 	struct {
 		std::uint8_t      backlight_luminosity;
 		backlight_pattern pattern;
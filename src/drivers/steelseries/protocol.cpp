@@ -0,0 +1,83 @@
+#include "drivers/steelseries/protocol.hpp"
+#include <stdexcept>
+#include <string>
+
+namespace drivers
+{
+namespace steelseries
+{
+namespace protocol
+{
+
+usb::packet_builder<max_packet_size> encode(
+    packet const& description, std::span<std::uint32_t const> values)
+{
+	usb::packet_builder<max_packet_size> builder;
+	builder.pad_to(description.size);
+
+	std::size_t next_value = 0;
+
+	for (auto const& current_field : description.fields) {
+		for (std::size_t i = 0; i < current_field.count; ++i) {
+			builder.at(current_field.offset + i * current_field.stride);
+
+			if (current_field.type == field::constant) {
+				builder.u8(current_field.value);
+				continue;
+			}
+
+			if (next_value >= values.size())
+				throw std::runtime_error("Not enough values for the packet");
+
+			auto const value =
+			    static_cast<std::int64_t>(values[next_value++]) +
+			    current_field.adjust;
+
+			switch (current_field.type) {
+			case field::u8:
+				builder.u8(value);
+				break;
+			case field::u16le:
+				builder.u16le(value);
+				break;
+			case field::u32le:
+				builder.u32le(value);
+				break;
+			case field::dpi:
+				builder.scaled(value, 100, 18'000, 0xd6);
+				break;
+			case field::constant:
+				break;
+			}
+		}
+	}
+
+	if (builder.size() != description.size)
+		throw std::runtime_error("Field outside of the packet");
+
+	if (next_value != values.size())
+		throw std::runtime_error("Too many values for the packet (expected " +
+		                         std::to_string(next_value) + ")");
+
+	return builder;
+}
+
+int send(usb::device const&             device,
+         packet const&                  description,
+         std::span<std::uint32_t const> values)
+{
+	auto const data = encode(description, values);
+	return send(device, description.interface, data.bytes());
+}
+
+int send(usb::device const&            device,
+         std::uint8_t                  interface,
+         std::span<std::uint8_t const> data)
+{
+	// This is a HID SET_REPORT request, for an output report
+	return device.control_transfer(0x21, 0x09, 0x0200, interface, data, 1000);
+}
+
+} // namespace protocol
+} // namespace steelseries
+} // namespace drivers
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "usb/device.hpp"
+#include "usb/packet_builder.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace drivers
+{
+namespace steelseries
+{
+
+// SteelSeries devices all take commands the same way: a packet sent as a HID
+// SET_REPORT control transfer to one of their interfaces, starting with the
+// command ID, with the values at fixed offsets after it.
+//
+// So instead of building packets by hand, drivers describe them as constexpr
+// tables of fields, and send them with protocol::send:
+//
+//  constexpr protocol::field poll_interval_fields[] = {
+//      {.type = protocol::field::constant, .offset = 0, .value = 0x6b},
+//      {.type = protocol::field::u8, .offset = 1, .adjust = -1},
+//  };
+//  constexpr protocol::packet poll_interval_packet{
+//      .interface = 3, .size = 2, .fields = poll_interval_fields};
+//
+//  std::array<std::uint32_t, 1> const values = {interval};
+//  protocol::send(*m_device, poll_interval_packet, values);
+namespace protocol
+{
+
+// Largest packet a device takes
+constexpr std::size_t max_packet_size = 64;
+
+struct field {
+	enum type {
+		u8,
+		u16le,
+		u32le,
+		// A DPI from 100 to 18000, which devices take as 0 to 0xd6
+		dpi,
+		// Always the same byte (ex. the command ID). Doesn't take a value.
+		constant,
+	};
+
+	enum type    type;
+	std::uint8_t offset;
+
+	// Added to the value before it's encoded. This is -1 for values
+	// numbered from 1 for humans, but from 0 by the device.
+	std::int32_t adjust = 0;
+
+	// Lists of values (ex. the DPI of each profile) are a field repeated
+	// every `stride` bytes. Each repetition takes a value.
+	std::uint8_t count  = 1;
+	std::uint8_t stride = 0;
+
+	// For constants
+	std::uint8_t value = 0;
+};
+
+struct packet {
+	std::uint8_t interface;
+
+	// Bytes not set by a field are 0
+	std::uint8_t size;
+
+	std::span<field const> fields;
+
+	// Number of values, from the first one, saying what the packet sets
+	// (ex. the zone of a color). Packets queued for a sleeping device are
+	// replaced by newer ones with the same key values (see wireless_link).
+	std::uint8_t key_values = 0;
+};
+
+// There must be exactly one value per non-constant field (repetition)
+usb::packet_builder<max_packet_size> encode(
+    packet const& description, std::span<std::uint32_t const> values);
+
+// Encodes and sends the packet to the device
+int send(usb::device const&             device,
+         packet const&                  description,
+         std::span<std::uint32_t const> values = {});
+
+// Sends a packet that was already encoded
+int send(usb::device const&            device,
+         std::uint8_t                  interface,
+         std::span<std::uint8_t const> data);
+
+} // namespace protocol
+} // namespace steelseries
+} // namespace drivers
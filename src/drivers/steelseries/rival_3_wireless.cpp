@@ -1,6 +1,11 @@
 #include "rival_3_wireless.hpp"
+#include "drivers/steelseries/protocol.hpp"
+#include "drivers/steelseries/wireless_link.hpp"
 #include "steelseries.hpp"
 #include "usb/device.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
 #include <memory.h>
 #include <string>
 #include <vector>
@@ -18,325 +23,355 @@ bool rival_3_wireless::is_compatible(std::shared_ptr<usb::device> device)
 	return false;
 }
 
-void rival_3_wireless::create_actions() noexcept
+namespace
 {
-	// TODO: Use those macros to create the actions and register them, like in
-	// steelseries::aerox_3_wireless
-#define CREATE_ACTION_HANDLER(action_name)                                     \
-	auto action_name##_handler = [this](                                       \
-	    std::vector<std::string> const& parameters)
-
-#define REGISTER_ACTION(action_name)                                           \
-	register_action(#action_name, action_name, action_name##_handler)
-
-#define CHECK_PARAMS_SIZE(minimum_size, action_name)                           \
-	if (parameters.size() < minimum_size)                                      \
-		throw std::runtime_error("Missing arguements for " #action_name);
-
-	action dpi_presset{
-	    .name        = "Active DPI presset",
-	    .description = "Set the active DPI presset",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 1, .max = 5}},
-	         .name        = "presset",
-	         .description = "The presset to enable (1-5)",
-        }},
-	};
 
-	auto dpi_presset_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error("Missig arguements for dpi_presset");
-
-		    std::uint8_t profile;
-		    try {
-			    auto val = std::stoi(parameters[0]);
-			    if (val < 1 || val > 5)
-				    throw std::runtime_error("Invalid profile");
-			    profile = val;
-		    } catch (std::invalid_argument const& e) {
-			    throw std::runtime_error("Couldn't parse number.");
-		    }
-
-		    m_config.active_profile = profile;
-		    set_dpi(profile, m_config.dpi_values);
-		    save_config();
-	    };
-
-	register_action("dpi_presset", dpi_presset, dpi_presset_handler);
-
-	action dpi_presset_config{
-	    .name        = "DPI Presset Configuration",
-	    .description = "Configure a DPI presset",
-	    .parameters =
-	        {// clang-format off
-				{
-					.type        = parameter::type::uint,
-					.type_info   = {.uint = {.min = 1, .max = 5}},
-					.name        = "presset",
-					.description = "The presset to change (1-5)",
-				},
-				{
-					.type        = parameter::type::uint,
-					.name        = "value",
-					.description = "DPI value (100-18000)",
-				}
-			},
-	    // clang-format on
-	};
+// Packets are a bit bigger than what we use for now, the rest is zeroes. They
+// all go to interface 3.
+constexpr protocol::field set_dpi_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x20},
+    // Number of profiles
+    {.type = protocol::field::u8, .offset = 1},
+    // Active profile
+    {.type = protocol::field::u8, .offset = 2},
+    // The DPI of each profile, every other byte
+    {.type = protocol::field::dpi, .offset = 3, .count = 5, .stride = 2},
+};
+constexpr protocol::packet set_dpi_packet{
+    .interface = 3,
+    .size      = 16,
+    .fields    = set_dpi_fields,
+};
+
+constexpr protocol::field set_poll_interval_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x17},
+    {.type = protocol::field::u8, .offset = 1, .adjust = 1},
+};
+constexpr protocol::packet set_poll_interval_packet{
+    .interface = 3,
+    .size      = 16,
+    .fields    = set_poll_interval_fields,
+};
+
+constexpr protocol::field set_powersaving_options_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x2b},
+    // Ultra power saving
+    {.type = protocol::field::u8, .offset = 1},
+    // Smart lighting
+    {.type = protocol::field::u8, .offset = 2},
+    // TODO: Those are probably for storing a delay, possibly the smart
+    //       lighting delay, but I haven't tested yet.
+    {.type = protocol::field::constant, .offset = 3, .value = 0x2c},
+    {.type = protocol::field::constant, .offset = 4, .value = 0x01},
+    // Sleep time
+    {.type = protocol::field::u16le, .offset = 5},
+};
+constexpr protocol::packet set_powersaving_options_packet{
+    .interface = 3,
+    .size      = 16,
+    .fields    = set_powersaving_options_fields,
+};
+
+constexpr protocol::field save_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0x09},
+};
+constexpr protocol::packet save_packet{
+    .interface = 3,
+    .size      = 1,
+    .fields    = save_fields,
+};
+
+// The answer comes as a 0xaa report on the event interface
+constexpr protocol::field request_battery_status_fields[] = {
+    {.type = protocol::field::constant, .offset = 0, .value = 0xaa},
+};
+constexpr protocol::packet request_battery_status_packet{
+    .interface = 3,
+    .size      = 1,
+    .fields    = request_battery_status_fields,
+};
+
+constexpr parameter dpi_presset_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 5}},
+        .name        = "presset",
+        .description = "The presset to enable (1-5)",
+    },
+};
+
+constexpr parameter dpi_presset_config_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 5}},
+        .name        = "presset",
+        .description = "The presset to change (1-5)",
+    },
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 100, .max = 18'000}},
+        .name        = "value",
+        .description = "DPI value (100-18000)",
+    },
+};
+
+constexpr parameter poll_interval_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.min = 1, .max = 4}},
+        .name        = "interval",
+        .description = "Interval between polls, in ms (1-4)",
+    },
+};
+
+constexpr parameter ultra_power_saving_parameters[] = {
+    {
+        .type        = parameter::type::bool_,
+        .name        = "enabled",
+        .description =
+            "Is Ultra Power Saving mode enabled? ('true' or 'false')",
+    },
+};
+
+constexpr parameter smart_lighting_parameters[] = {
+    {
+        .type        = parameter::type::bool_,
+        .name        = "enabled",
+        .description = "Is smart lighting mode enabled? ('true' or 'false')",
+    },
+};
+
+constexpr parameter sleep_time_parameters[] = {
+    {
+        .type        = parameter::type::uint,
+        .type_info   = {.uint = {.max = 0xffff}},
+        .name        = "time",
+        .description = "Time before going to sleep (in seconds)",
+    },
+};
+
+} // namespace
+
+#define HANDLER(action_name)                                                   \
+	bind_handler<rival_3_wireless, &rival_3_wireless::action_name##_handler>
+
+constexpr action rival_3_wireless::actions[] = {
+    {
+        .id          = "dpi_presset",
+        .name        = "Active DPI presset",
+        .description = "Set the active DPI presset",
+        .parameters  = dpi_presset_parameters,
+        .run         = HANDLER(dpi_presset),
+    },
+    {
+        .id          = "dpi_presset_config",
+        .name        = "DPI Presset Configuration",
+        .description = "Configure a DPI presset",
+        .parameters  = dpi_presset_config_parameters,
+        .run         = HANDLER(dpi_presset_config),
+    },
+    {
+        .id          = "poll_interval",
+        .name        = "Poll interval",
+        .description = "Set the poll interval",
+        .parameters  = poll_interval_parameters,
+        .run         = HANDLER(poll_interval),
+    },
+    {
+        .id          = "ultra_power_saving",
+        .name        = "Ultra power saving",
+        .description = "Ultra power saving mode",
+        .parameters  = ultra_power_saving_parameters,
+        .run         = HANDLER(ultra_power_saving),
+    },
+    {
+        .id          = "smart_lighting",
+        .name        = "Smart lighting",
+        .description = "Smart lighting mode",
+        .parameters  = smart_lighting_parameters,
+        .run         = HANDLER(smart_lighting),
+    },
+    {
+        .id          = "sleep_time",
+        .name        = "Sleep time",
+        .description = "Sleep time",
+        .parameters  = sleep_time_parameters,
+        .run         = HANDLER(sleep_time),
+    },
+    {
+        .id          = "save",
+        .name        = "Save",
+        .description = "Save to onboard memory",
+        .run         = HANDLER(save),
+    },
+};
+
+#undef HANDLER
+
+std::span<action const> rival_3_wireless::get_actions() const noexcept
+{
+	return actions;
+}
 
-	auto dpi_presset_config_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 2)
-			    throw std::runtime_error(
-			        "Missig arguements for dpi_presset_config");
-
-		    std::uint8_t  profile;
-		    std::uint16_t new_value;
-		    try {
-			    auto _profile = std::stoi(parameters[0]);
-			    if (_profile < 1 || _profile > 5)
-				    throw std::runtime_error("Invalid profile");
-			    profile = _profile;
-
-			    auto _new_value = std::stoi(parameters[1]);
-			    if (_new_value < 100 || _new_value > 18000)
-				    throw std::runtime_error("Invalid DPI value");
-			    new_value = _new_value;
-
-		    } catch (std::invalid_argument const& e) {
-			    throw std::runtime_error("Couldn't parse number.");
-		    }
-
-		    m_config.dpi_values[profile - 1] = new_value;
-		    set_dpi(m_config.active_profile, m_config.dpi_values);
-		    save_config();
-	    };
-
-	register_action(
-	    "dpi_presset_config", dpi_presset_config, dpi_presset_config_handler);
-
-	action poll_interval{
-	    .name        = "Poll interval",
-	    .description = "Set the poll interval",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.min = 1, .max = 4}},
-	         .name        = "interval",
-	         .description = "Interval between polls, in ms (1-4)",
-        }},
-	};
+delivery rival_3_wireless::dpi_presset_handler(arguments const& args)
+{
+	return apply_active_dpi_profile(static_cast<std::uint8_t>(args.uint(0)));
+}
 
-	auto poll_interval_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for set_poll_interval");
-
-		    std::uint8_t interval;
-		    try {
-			    auto _interval = std::stoi(parameters[0]);
-			    if (_interval > 4 || _interval < 1)
-				    throw std::runtime_error(
-				        "Invalid poll interval, value must be between 1 and 4");
-			    interval = _interval;
-		    } catch (std::invalid_argument const& e) {
-			    throw std::runtime_error("Couldn't parse number.");
-		    }
-
-		    // TODO: Save to m_config
-		    set_poll_interval(interval);
-	    };
-
-	register_action("poll_interval", poll_interval, poll_interval_handler);
-
-	action ultra_power_saving{
-	    .name        = "Ultra power saving",
-	    .description = "Ultra power saving mode",
-	    .parameters  = {{
-	         .type = parameter::type::bool_,
-	         .name = "enabled",
-	         .description =
-                "Is Ultra Power Saving mode enabled? ('true' or 'false')",
-        }},
-	};
+delivery rival_3_wireless::dpi_presset_config_handler(arguments const& args)
+{
+	auto const profile   = args.uint(0);
+	auto const new_value = static_cast<std::uint16_t>(args.uint(1));
 
-	auto ultra_power_saving_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for ultra_power_saving");
-
-		    bool is_active = parameters[0] == "true";
-
-		    m_config.ultra_power_saving_mode = is_active;
-		    set_powersaving_options(
-		        is_active, m_config.smart_lighting_mode, m_config.sleep_time);
-		    save_config();
-	    };
-
-	register_action(
-	    "ultra_power_saving", ultra_power_saving, ultra_power_saving_handler);
-
-	action smart_lighting{
-	    .name        = "Smart lighting",
-	    .description = "Smart lighting mode",
-	    .parameters  = {{
-	         .type = parameter::type::string,
-	         .name = "enabled",
-	         .description =
-                "Is smart lighting mode enabled? ('true' or 'false')",
-        }},
-	};
+	m_config.dpi_values[profile - 1] = new_value;
 
-	auto smart_lighting_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error(
-			        "Missig arguements for smart_lighting");
-
-		    bool is_active = parameters[0] == "true";
-
-		    m_config.smart_lighting_mode = is_active;
-		    set_powersaving_options(m_config.ultra_power_saving_mode,
-		                            is_active,
-		                            m_config.sleep_time);
-		    save_config();
-	    };
-
-	register_action("smart_lighting", smart_lighting, smart_lighting_handler);
-
-	action sleep_time{
-	    .name        = "Sleep time",
-	    .description = "Sleep time",
-	    .parameters  = {{
-	         .type        = parameter::type::uint,
-	         .type_info   = {.uint = {.max = 0xff}},
-	         .name        = "time",
-	         .description = "Time before going to sleep (in seconds)",
-        }},
-	};
+	auto const result = set_dpi(m_config.active_profile, m_config.dpi_values);
+	save_config();
+	return result;
+}
 
-	auto sleep_time_handler =
-	    [this](std::vector<std::string> const& parameters) {
-		    if (parameters.size() < 1)
-			    throw std::runtime_error("Missig arguements for sleep_time");
-
-		    std::uint16_t sleep_time;
-		    try {
-			    auto _sleep_time = std::stoi(parameters[0]);
-			    // TODO: Is there a max. value? The GUI goes up to 20 minutes...
-			    if (_sleep_time < 0)
-				    throw std::runtime_error("Invalid value for sleep_time");
-
-			    sleep_time = _sleep_time;
-		    } catch (std::runtime_error const& e) {
-			    throw std::runtime_error("Couldn't parse number");
-		    }
-
-		    m_config.sleep_time = sleep_time;
-		    set_powersaving_options(m_config.ultra_power_saving_mode,
-		                            m_config.smart_lighting_mode,
-		                            sleep_time);
-		    save_config();
-	    };
-
-	register_action("sleep_time", sleep_time, sleep_time_handler);
-
-	action save{
-	    .name        = "Save",
-	    .description = "Save to onboard memory",
-	    .parameters  = {},
-	};
+delivery rival_3_wireless::poll_interval_handler(arguments const& args)
+{
+	return apply_poll_interval(static_cast<std::uint8_t>(args.uint(0)));
+}
 
-	auto save_handler = [this](std::vector<std::string> const&) {
-		this->save();
-		save_config();
-	};
+delivery rival_3_wireless::ultra_power_saving_handler(arguments const& args)
+{
+	auto const is_active = args.bool_(0);
 
-	register_action("save", save, save_handler);
+	m_config.ultra_power_saving_mode = is_active;
 
-#undef CREATE_ACTION_HANDLER
-#undef REGISTER_ACTION
-#undef CHECK_PARAMS_SIZE
+	auto const result = set_powersaving_options(
+	    is_active, m_config.smart_lighting_mode, m_config.sleep_time);
+	save_config();
+	return result;
 }
 
-void rival_3_wireless::set_dpi(std::uint8_t               active_profile_id,
-                               std::vector<std::uint16_t> dpi_profiles) const
+delivery rival_3_wireless::smart_lighting_handler(arguments const& args)
 {
-	// The data to send. This is a bit more than what we use for now
-	std::vector<std::uint8_t> data(16);
-	data.assign(16, 0); // zero-out all the data by default
-
-	data[0] = 0x20;                // This is the ID
-	data[1] = dpi_profiles.size(); // Profile count
-	data[2] = active_profile_id;   // Profile ID
-
-	// Need to scale the dpi from 100-18000 to 0-0xd6
-	std::vector<std::uint8_t> scaled_dpis(dpi_profiles.size());
-
-	auto scale_value = [](std::uint16_t dpi) -> std::uint8_t {
-		auto new_val = ((float)(dpi - 100) / (18000 - 100)) * 0xd6;
-		if (new_val > 0xd6) return 0xd6;
-		if (new_val < 0) return 0;
-		return new_val;
-	};
+	auto const is_active = args.bool_(0);
 
-	// TODO: Handle profile_count < 5 properly
-	for (std::size_t i = 0; i < dpi_profiles.size(); ++i)
-		scaled_dpis[i] = scale_value(dpi_profiles[i]);
+	m_config.smart_lighting_mode = is_active;
 
-	data[3]  = scaled_dpis[0]; // Profile 1 DPI
-	data[5]  = scaled_dpis[1]; // Profile 2 DPI
-	data[7]  = scaled_dpis[2]; // Profile 3 DPI
-	data[9]  = scaled_dpis[3]; // Profile 4 DPI
-	data[11] = scaled_dpis[4]; // Profile 5 DPI
+	auto const result = set_powersaving_options(
+	    m_config.ultra_power_saving_mode, is_active, m_config.sleep_time);
+	save_config();
+	return result;
+}
+
+delivery rival_3_wireless::sleep_time_handler(arguments const& args)
+{
+	return apply_sleep_timeout(args.uint(0));
+}
 
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+delivery rival_3_wireless::save_handler(arguments const&)
+{
+	return save_to_onboard_memory();
 }
 
-void rival_3_wireless::set_poll_interval(std::uint8_t interval) const
+delivery rival_3_wireless::apply_dpi_profiles(
+    std::span<std::uint16_t const> dpis)
 {
-	// The data to send. This is a bit more than what we use for now
-	std::vector<std::uint8_t> data(16);
-	data.assign(16, 0); // zero-out all the data by default
+	if (dpis.size() > dpi_profile_count())
+		throw std::runtime_error("Too many DPI profiles, must be <5");
+	for (auto const dpi : dpis)
+		utils::ensure_range(dpi, 100, 18'000, "DPI");
+
+	std::copy(dpis.begin(), dpis.end(), m_config.dpi_values.begin());
+	auto const result = set_dpi(m_config.active_profile, m_config.dpi_values);
+	save_config();
+	return result;
+}
 
-	data[0] = 0x17; // This is the ID
-	data[1] = interval + 1;
+delivery rival_3_wireless::apply_active_dpi_profile(std::uint8_t profile)
+{
+	utils::ensure_range(profile, 1, 5, "Profile ID");
 
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+	m_config.active_profile = profile;
+	auto const result       = set_dpi(profile, m_config.dpi_values);
+	save_config();
+	return result;
 }
 
-void rival_3_wireless::set_powersaving_options(bool          ultra_power_saving,
-                                               bool          smart_lighting,
-                                               std::uint16_t sleep_time) const
+delivery rival_3_wireless::apply_poll_interval(std::uint8_t interval_ms)
 {
-	// The data to send. This is a bit more than what we use for now
-	std::vector<std::uint8_t> data(16);
-	data.assign(16, 0); // zero-out all the data by default
+	m_config.poll_interval = interval_ms;
+	auto const result      = set_poll_interval(interval_ms);
+	save_config();
+	return result;
+}
 
-	data[0] = 0x2b; // This is the ID
-	data[1] = ultra_power_saving;
+delivery rival_3_wireless::apply_sleep_timeout(std::uint32_t seconds)
+{
+	// TODO: Is there a max. value? The GUI goes up to 20 minutes...
+	utils::ensure_range(seconds, 0u, 0xffffu, "Sleep time");
 
-	// TODO: I don't really know how this value works :/
-	data[2] = smart_lighting ? 0x32 : 0x00;
-	if (ultra_power_saving) data[2] = 0x64;
+	m_config.sleep_time = seconds;
 
-	// TODO: data[3] && data[4] are probably for storing a delay, possibly the
-	//       smart lighting delay, but I haven't tested yet.
-	data[3] = 0x2c;
-	data[4] = 0x01;
+	auto const result =
+	    set_powersaving_options(m_config.ultra_power_saving_mode,
+	                            m_config.smart_lighting_mode,
+	                            m_config.sleep_time);
+	save_config();
+	return result;
+}
+
+delivery rival_3_wireless::save_to_onboard_memory()
+{
+	auto const result = save();
+	save_config();
+	return result;
+}
+
+delivery rival_3_wireless::set_dpi(
+    std::uint8_t               active_profile_id,
+    std::vector<std::uint16_t> dpi_profiles) const
+{
+	if (dpi_profiles.size() > 5)
+		throw std::runtime_error("Too many DPI profiles, must be <5");
+
+	// TODO: Handle profile_count < 5 properly. For now, missing profiles are
+	//       sent as 0.
+	std::array<std::uint32_t, 7> values = {
+	    static_cast<std::uint32_t>(dpi_profiles.size()),
+	    active_profile_id,
+	};
+	std::copy(dpi_profiles.begin(), dpi_profiles.end(), values.begin() + 2);
+
+	return m_link.send(set_dpi_packet, values);
+}
+
+delivery rival_3_wireless::set_poll_interval(std::uint8_t interval) const
+{
+	std::array<std::uint32_t, 1> const values = {interval};
+	return m_link.send(set_poll_interval_packet, values);
+}
+
+delivery rival_3_wireless::set_powersaving_options(
+    bool          ultra_power_saving,
+    bool          smart_lighting,
+    std::uint16_t sleep_time) const
+{
+	// TODO: I don't really know how this value works :/
+	std::uint32_t lighting_value = smart_lighting ? 0x32 : 0x00;
+	if (ultra_power_saving) lighting_value = 0x64;
 
-	data[5] = sleep_time & 0xff;        // Take the bottom 8 bits of sleep_time
-	data[6] = (sleep_time >> 8) & 0xff; // Take the top 8 bits of sleep_time
+	std::array<std::uint32_t, 3> const values = {
+	    ultra_power_saving,
+	    lighting_value,
+	    sleep_time,
+	};
+	return m_link.send(set_powersaving_options_packet, values);
+}
 
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, data, 1000);
+delivery rival_3_wireless::save() const
+{
+	return m_link.send(save_packet);
 }
 
-void rival_3_wireless::save() const
+void rival_3_wireless::request_battery_status() const
 {
-	m_device->control_transfer(0x21, 0x09, 0x0200, 3, {0x09}, 1000);
+	m_link.send(request_battery_status_packet);
 }
 
 // TODO: This doesn't do anything ;(
@@ -413,6 +448,36 @@ void rival_3_wireless::set_static_color(std::uint8_t r,
 	}
 }
 
+std::optional<device_event> rival_3_wireless::decode_event(
+    std::span<std::uint8_t const> report)
+{
+	if (report.size() < 2) return {};
+
+	switch (report[0]) {
+	case 0xaa: // Battery status, sent in response to a 0xaa request
+		// This mouse doesn't report whether it's charging
+		return device_event{
+		    .type  = device_event::battery,
+		    .value = std::min<std::uint32_t>(report[1], 100),
+		};
+	// TODO: Captures also show 0x40 (the receiver lost/found the mouse) and
+	//       0x21 (DPI button) reports, decode them once their layout is
+	//       confirmed
+	}
+
+	return {};
+}
+
+void rival_3_wireless::write_state(state_writer& writer) const
+{
+	writer.uint_list("dpi_values", m_config.dpi_values);
+	writer.uint("active_profile", m_config.active_profile);
+	writer.bool_("ultra_power_saving_mode", m_config.ultra_power_saving_mode);
+	writer.bool_("smart_lighting_mode", m_config.smart_lighting_mode);
+	writer.uint("sleep_time", m_config.sleep_time);
+	writer.uint("poll_interval", m_config.poll_interval);
+}
+
 nlohmann::json rival_3_wireless::serialize_current_config() const noexcept
 {
 	return {
@@ -421,15 +486,22 @@ nlohmann::json rival_3_wireless::serialize_current_config() const noexcept
 	    {"ultra_power_saving_mode", m_config.ultra_power_saving_mode},
 	    {    "smart_lighting_mode",     m_config.smart_lighting_mode},
 	    {             "sleep_time",              m_config.sleep_time},
+	    {          "poll_interval",           m_config.poll_interval},
 	};
 }
 
 // TODO: Check if values are valid?
 void rival_3_wireless::deserialize_config(nlohmann::json const& config_on_disk)
 {
-	auto const& config_dpi_values =
+	m_config.dpi_values =
 	    config_on_disk.value<std::vector<std::uint16_t>>("dpi_values", {});
-	m_config.dpi_values = config_dpi_values;
+
+	// Profiles missing from the config (all of them on a new one, or after
+	// a config saved with none) get their default
+	constexpr std::uint16_t default_dpi_values[] = {400, 800, 1200, 2400, 3200};
+	for (auto i = m_config.dpi_values.size(); i < dpi_profile_count(); ++i)
+		m_config.dpi_values.push_back(default_dpi_values[i]);
+	m_config.dpi_values.resize(dpi_profile_count());
 
 	m_config.active_profile = config_on_disk.value("active_profile", 1);
 
@@ -440,6 +512,8 @@ void rival_3_wireless::deserialize_config(nlohmann::json const& config_on_disk)
 	    config_on_disk.value("smart_lighting_mode", true);
 
 	m_config.sleep_time = config_on_disk.value("sleep_time", 300);
+
+	m_config.poll_interval = config_on_disk.value("poll_interval", 1);
 }
 
 } // namespace steelseries
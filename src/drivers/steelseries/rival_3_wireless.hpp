@@ -1,7 +1,12 @@
 #pragma once
 
+#include "drivers/capabilities.hpp"
 #include "drivers/driver.hpp"
+#include "drivers/events.hpp"
+#include "drivers/steelseries/wireless_link.hpp"
 #include "usb/device.hpp"
+#include <optional>
+#include <span>
 #include <memory.h>
 
 namespace drivers
@@ -9,15 +14,18 @@ namespace drivers
 namespace steelseries
 {
 
-class rival_3_wireless final : public driver
+class rival_3_wireless final : public driver,
+                               public capabilities::dpi_table,
+                               public capabilities::poll_rate,
+                               public capabilities::sleep_timeout,
+                               public capabilities::onboard_save,
+                               public capabilities::battery_status
 {
   public:
 	rival_3_wireless(std::shared_ptr<usb::device>    dev,
 	                 std::shared_ptr<config_manager> config)
-	    : driver(dev, config)
+	    : driver(dev, config), m_link(dev, m_events)
 	{
-		create_actions();
-		deserialize_config(config->get_device_config(config_id()));
 	}
 
 	static bool is_compatible(std::shared_ptr<usb::device>);
@@ -32,30 +40,65 @@ class rival_3_wireless final : public driver
 		return "SteelSeries Rival 3 Wireless";
 	};
 
+	std::span<action const> get_actions() const noexcept final;
+
 	void set_static_color(std::uint8_t r, std::uint8_t g, std::uint8_t b) const;
-	void set_dpi(std::uint8_t               active_profile_id,
-	             std::vector<std::uint16_t> dpi_profiles) const;
-	void set_poll_interval(std::uint8_t interval) const;
-	void set_powersaving_options(bool          ultra_power_saving,
-	                             bool          smart_lighting,
-	                             std::uint16_t sleep_time) const;
-	void save() const;
+	delivery set_dpi(std::uint8_t               active_profile_id,
+	                 std::vector<std::uint16_t> dpi_profiles) const;
+	delivery set_poll_interval(std::uint8_t interval) const;
+	delivery set_powersaving_options(bool          ultra_power_saving,
+	                                 bool          smart_lighting,
+	                                 std::uint16_t sleep_time) const;
+	delivery save() const;
+
+	std::size_t dpi_profile_count() const noexcept final { return 5; }
+	delivery apply_dpi_profiles(std::span<std::uint16_t const> dpis) final;
+	delivery apply_active_dpi_profile(std::uint8_t profile) final;
+
+	delivery apply_poll_interval(std::uint8_t interval_ms) final;
+	delivery apply_sleep_timeout(std::uint32_t seconds) final;
+	delivery save_to_onboard_memory() final;
+
+	void request_battery_status() const final;
+
+	bool is_asleep() const noexcept final { return !m_link.is_awake(); }
+
+	std::optional<event_source> get_event_source() const noexcept final
+	{
+		return event_source{.interface = 3, .decode = decode_event};
+	}
 
   protected:
+	void write_state(state_writer& writer) const override final;
 	nlohmann::json serialize_current_config() const noexcept override final;
 	void           deserialize_config(
 	              nlohmann::json const& config_on_disk) override final;
 
-	void create_actions() noexcept override final;
-
   private:
+	static action const actions[];
+
+	delivery dpi_presset_handler(arguments const&);
+	delivery dpi_presset_config_handler(arguments const&);
+	delivery poll_interval_handler(arguments const&);
+	delivery ultra_power_saving_handler(arguments const&);
+	delivery smart_lighting_handler(arguments const&);
+	delivery sleep_time_handler(arguments const&);
+	delivery save_handler(arguments const&);
+
+	static std::optional<device_event> decode_event(
+	    std::span<std::uint8_t const> report);
+
 	struct {
 		std::vector<std::uint16_t> dpi_values{400, 800, 1200, 2400, 3200};
 		std::uint8_t               active_profile          = 1;
 		bool                       ultra_power_saving_mode = false;
 		bool                       smart_lighting_mode     = true;
 		std::uint16_t              sleep_time              = 300;
+		std::uint8_t               poll_interval           = 1;
 	} m_config;
+
+	// Setters only send packets, they don't change the driver's state
+	mutable wireless_link m_link;
 };
 
 } // namespace steelseries
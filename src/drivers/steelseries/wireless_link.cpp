@@ -0,0 +1,173 @@
+#include "drivers/steelseries/wireless_link.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace drivers
+{
+namespace steelseries
+{
+
+delivery wireless_link::send(protocol::packet const&        description,
+                             std::span<std::uint32_t const> values)
+{
+	auto const data = protocol::encode(description, values);
+
+	{
+		std::lock_guard lock(m_mutex);
+
+		// While flushing, packets go after the ones already queued, so they
+		// reach the device in order
+		if (!m_awake || m_flushing) {
+			enqueue(description, values);
+			return queued;
+		}
+	}
+
+	try {
+		protocol::send(*m_device, description.interface, data.bytes());
+		return sent;
+	} catch (usb::transfer_error const& e) {
+		if (e.code() != LIBUSB_ERROR_TIMEOUT) throw;
+
+		// The receiver couldn't reach the device, it's most likely asleep
+		bool fell_asleep;
+		{
+			std::lock_guard lock(m_mutex);
+			fell_asleep = std::exchange(m_awake, false);
+			enqueue(description, values);
+		}
+
+		if (fell_asleep) publish_awake(false);
+		return queued;
+	}
+}
+
+bool wireless_link::is_awake() const noexcept
+{
+	std::lock_guard lock(m_mutex);
+	return m_awake;
+}
+
+std::vector<wireless_link::queued_packet>::iterator wireless_link::find_queued(
+    protocol::packet const&        description,
+    std::span<std::uint32_t const> values)
+{
+	auto const key_count =
+	    std::min<std::size_t>(description.key_values, values.size());
+
+	return std::find_if(
+	    m_queue.begin(), m_queue.end(), [&](queued_packet const& queued) {
+		    return queued.description == &description &&
+		           std::equal(values.begin(),
+		                      values.begin() + key_count,
+		                      queued.values.begin());
+	    });
+}
+
+void wireless_link::enqueue(protocol::packet const&        description,
+                            std::span<std::uint32_t const> values)
+{
+	// Replaced in place, so the device gets packets in the order they were
+	// first sent (ex. a save stays after the settings it saves)
+	auto const existing = find_queued(description, values);
+	if (existing != m_queue.end())
+		existing->values.assign(values.begin(), values.end());
+	else
+		m_queue.push_back({&description, {values.begin(), values.end()}});
+
+	// Whatever is queued is always being flushed, so a packet is never left
+	// waiting for a wake up nobody will notice
+	if (m_flushing) return;
+
+	// The previous flusher cleared m_flushing as its last step, so this
+	// doesn't wait on anything
+	m_flushing = true;
+	m_flusher  = std::jthread([this](std::stop_token stop) { flush(stop); });
+}
+
+void wireless_link::flush(std::stop_token stop)
+{
+	auto delay = min_retry_delay;
+
+	while (true) {
+		{
+			// Don't keep the receiver busy while the device sleeps, it may
+			// sleep for hours
+			std::unique_lock lock(m_mutex);
+			if (!m_awake) {
+				m_retry.wait_for(lock, stop, delay, []() { return false; });
+				if (stop.stop_requested()) return;
+
+				delay = std::min(delay * 2, max_retry_delay);
+			}
+		}
+
+		if (send_queued()) return;
+	}
+}
+
+bool wireless_link::send_queued()
+{
+	while (true) {
+		queued_packet next;
+
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_queue.empty()) {
+				m_flushing = false;
+				return true;
+			}
+
+			next = std::move(m_queue.front());
+			m_queue.erase(m_queue.begin());
+		}
+
+		try {
+			protocol::send(*m_device, *next.description, next.values);
+		} catch (usb::transfer_error const& e) {
+			if (e.code() != LIBUSB_ERROR_TIMEOUT) {
+				utils::daemon::log(e.what(), utils::daemon::log_level::error);
+				continue;
+			}
+
+			// Still (or back) asleep. Keep the packet for next time, unless
+			// a newer one replaced it in the meantime.
+			bool fell_asleep;
+			{
+				std::lock_guard lock(m_mutex);
+				if (find_queued(*next.description, next.values) ==
+				    m_queue.end())
+					m_queue.insert(m_queue.begin(), std::move(next));
+
+				fell_asleep = std::exchange(m_awake, false);
+			}
+
+			if (fell_asleep) publish_awake(false);
+			return false;
+		} catch (std::runtime_error const& e) {
+			utils::daemon::log(e.what(), utils::daemon::log_level::error);
+			continue;
+		}
+
+		// The device answered, so it's awake
+		bool woke_up;
+		{
+			std::lock_guard lock(m_mutex);
+			woke_up = !std::exchange(m_awake, true);
+		}
+
+		if (woke_up) publish_awake(true);
+	}
+}
+
+void wireless_link::publish_awake(bool awake) const
+{
+	m_events.publish({
+	    .type = awake ? device_event::awake : device_event::asleep,
+	});
+}
+
+} // namespace steelseries
+} // namespace drivers
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "drivers/driver.hpp"
+#include "drivers/events.hpp"
+#include "drivers/steelseries/protocol.hpp"
+#include "usb/device.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace drivers
+{
+namespace steelseries
+{
+
+// Wireless devices are reached through their receiver, which can't deliver
+// packets while the device sleeps: they time out. So instead of making the
+// client wait for that, packets sent to a sleeping device are queued, and
+// sent once it wakes up.
+//
+// There's no confirmed report telling when the device wakes up, so a thread
+// tries sending the queue again, less and less often while it times out.
+// Changes are published as awake and asleep events.
+//
+// Queued packets are coalesced: a packet replaces a queued one setting the
+// same thing (see protocol::packet::key_values), so the device only gets the
+// final state once it wakes up.
+class wireless_link
+{
+  public:
+	static constexpr std::chrono::seconds min_retry_delay{5};
+	static constexpr std::chrono::seconds max_retry_delay{60};
+
+	wireless_link(std::shared_ptr<usb::device> device, event_stream& events)
+	    : m_device(device), m_events(events)
+	{
+	}
+
+	wireless_link(wireless_link const&)            = delete;
+	wireless_link& operator=(wireless_link const&) = delete;
+
+	// The values are checked (by encoding the packet) even if the packet is
+	// queued, so errors are reported right away
+	delivery send(protocol::packet const&        description,
+	              std::span<std::uint32_t const> values = {});
+
+	// Devices are assumed to be awake until a packet times out, and until a
+	// queued packet gets through after that
+	bool is_awake() const noexcept;
+
+  private:
+	struct queued_packet {
+		protocol::packet const*    description;
+		std::vector<std::uint32_t> values;
+	};
+
+	// The queued packet setting the same thing, if any. The lock must be
+	// held.
+	std::vector<queued_packet>::iterator find_queued(
+	    protocol::packet const&        description,
+	    std::span<std::uint32_t const> values);
+
+	// Queues the packet, and makes sure the flusher runs. The lock must be
+	// held.
+	void enqueue(protocol::packet const&        description,
+	             std::span<std::uint32_t const> values);
+
+	// Sends the queue until it's empty, waiting between tries while the
+	// device doesn't answer
+	void flush(std::stop_token stop);
+
+	// Sends the queued packets, returns false if the device didn't answer
+	bool send_queued();
+
+	void publish_awake(bool awake) const;
+
+	std::shared_ptr<usb::device> m_device;
+	event_stream&                m_events;
+
+	mutable std::mutex          m_mutex;
+	std::condition_variable_any m_retry;
+	bool                        m_awake    = true;
+	bool                        m_flushing = false;
+	std::vector<queued_packet>  m_queue;
+
+	// Declared last, so it's stopped before anything it uses is destroyed
+	std::jthread m_flusher;
+};
+
+} // namespace steelseries
+} // namespace drivers
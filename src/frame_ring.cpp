@@ -0,0 +1,150 @@
+#include "frame_ring.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr std::size_t align_up(std::size_t value, std::size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+frame_ring::frame_ring(std::shared_ptr<drivers::driver> driver,
+                       std::uint32_t                    fps)
+    : m_driver(driver)
+{
+	using drivers::capabilities::zone_lighting;
+	m_lighting = drivers::capabilities::get<zone_lighting>(*m_driver);
+
+	if (!m_lighting || m_lighting->lighting_zone_count() == 0)
+		throw std::runtime_error("Device doesn't have any lighting zone");
+
+	auto const zone_count = m_lighting->lighting_zone_count();
+
+	utils::ensure_range(fps, 1u, max_fps, "FPS");
+	m_frame_interval = std::chrono::microseconds(1'000'000 / fps);
+
+	auto const slots_offset = align_up(sizeof(frame_ring_header), 64);
+	m_frame_size = align_up(zone_count * sizeof(drivers::rgb), 4);
+	m_size       = slots_offset + m_frame_size * slot_count;
+
+	m_fd = memfd_create("openfdd-frame-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (m_fd < 0) throw std::runtime_error("Couldn't create frame ring memfd");
+
+	if (ftruncate(m_fd, m_size) < 0) {
+		close(m_fd);
+		throw std::runtime_error("Couldn't resize frame ring memfd");
+	}
+
+	// Prevent the producer from resizing the memory from under our feet, which
+	// would crash the daemon with a SIGBUS
+	fcntl(m_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	auto* memory =
+	    mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (memory == MAP_FAILED) {
+		close(m_fd);
+		throw std::runtime_error("Couldn't map frame ring memory");
+	}
+
+	m_header = new (memory) frame_ring_header{
+	    .magic             = frame_ring_header::expected_magic,
+	    .version           = frame_ring_header::expected_version,
+	    .zone_count        = static_cast<std::uint32_t>(zone_count),
+	    .slot_count        = slot_count,
+	    .frame_size        = static_cast<std::uint32_t>(m_frame_size),
+	    .frame_interval_us =
+	        static_cast<std::uint32_t>(m_frame_interval.count()),
+	    .sequence          = 0,
+	};
+	m_slots = static_cast<std::uint8_t*>(memory) + slots_offset;
+
+	m_frame.resize(zone_count);
+	m_applied_frame.resize(zone_count);
+
+	m_consumer = std::jthread([this](std::stop_token stop) { consume(stop); });
+}
+
+frame_ring::~frame_ring() noexcept
+{
+	// Stop the consumer before unmapping the memory it reads from
+	m_consumer.request_stop();
+	if (m_consumer.joinable()) m_consumer.join();
+
+	munmap(m_header, m_size);
+	close(m_fd);
+}
+
+bool frame_ring::read_latest_frame()
+{
+	auto sequence = m_header->sequence.load(std::memory_order_acquire);
+
+	// Only retry a few times, a producer lapping us continuously shouldn't
+	// hold the consumer forever. We'll catch up on the next frame.
+	for (auto attempt = 0; attempt < 3; ++attempt) {
+		if (sequence == m_last_sequence) return false;
+
+		auto const* slot = m_slots + (sequence % slot_count) * m_frame_size;
+		std::memcpy(
+		    m_frame.data(), slot, m_frame.size() * sizeof(drivers::rgb));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto const latest = m_header->sequence.load(std::memory_order_relaxed);
+
+		// If the producer went all the way around the ring while we were
+		// copying, the slot may have been half-written. Retry with the newest
+		// frame in that case.
+		if (latest - sequence < slot_count - 1) {
+			m_last_sequence = sequence;
+			return true;
+		}
+
+		sequence = latest;
+	}
+
+	return false;
+}
+
+void frame_ring::consume(std::stop_token stop)
+{
+	auto next_tick = std::chrono::steady_clock::now();
+
+	while (!stop.stop_requested()) {
+		next_tick += m_frame_interval;
+
+		// Don't try to catch up on missed frames if the device is slower than
+		// the requested frame rate, we only care about the latest one anyways
+		auto const now = std::chrono::steady_clock::now();
+		if (next_tick < now) next_tick = now;
+
+		std::this_thread::sleep_until(next_tick);
+
+		if (!read_latest_frame()) continue;
+
+		// Clients and tasks may be using the device at the same time
+		auto const lock = m_driver->lock();
+
+		// Only send the zones that changed, each one costs a USB transfer
+		for (std::size_t zone = 0; zone < m_frame.size(); ++zone) {
+			if (m_frame[zone] == m_applied_frame[zone]) continue;
+
+			try {
+				m_lighting->set_zone_color(zone, m_frame[zone]);
+				m_applied_frame[zone] = m_frame[zone];
+			} catch (std::runtime_error const& e) {
+				// Once per frame at worst, the rate limit keeps it in check
+				utils::daemon::log("Frame ring: couldn't send the frame",
+				                   {{"error", e.what()}},
+				                   utils::daemon::log_level::error);
+			}
+		}
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "drivers/capabilities.hpp"
+#include "drivers/driver.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Shared-memory ring used by external producers (music visualizers, games,
+// ...) to stream lighting frames to a device without going through the
+// socket for every frame.
+//
+// The memory is a memfd handed to the client over the socket. Its layout is:
+//
+//   [frame_ring_header][slot 0][slot 1]...
+//
+// The header is padded to a multiple of 64 bytes (128 bytes in version 1).
+//
+// Each slot holds one frame: `zone_count` RGB triples (3 bytes each), padded
+// to `frame_size` bytes.
+//
+// To publish a frame, a producer writes it to the slot
+// `(sequence + 1) % slot_count`, then stores `sequence + 1` in `sequence`
+// with release semantics. No syscall is needed on the producer side.
+//
+// The daemon checks `sequence` once per frame period, and sends the latest
+// frame to the device when it changed.
+struct frame_ring_header {
+	static constexpr std::uint32_t expected_magic   = 0x5244464f; // "OFDR"
+	static constexpr std::uint32_t expected_version = 1;
+
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint32_t zone_count;
+	std::uint32_t slot_count;
+	std::uint32_t frame_size;
+	std::uint32_t frame_interval_us;
+
+	alignas(64) std::atomic<std::uint64_t> sequence;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "The frame ring needs a lock-free 64-bit counter to be shared "
+              "between processes");
+
+class frame_ring
+{
+  public:
+	static constexpr std::uint32_t slot_count = 4;
+	static constexpr std::uint32_t max_fps    = 240;
+
+	frame_ring(std::shared_ptr<drivers::driver> driver, std::uint32_t fps);
+	~frame_ring() noexcept;
+
+	frame_ring(frame_ring const&)            = delete;
+	frame_ring& operator=(frame_ring const&) = delete;
+
+	// The memfd backing the ring, to be passed to the producer
+	int fd() const noexcept { return m_fd; }
+
+	std::size_t size() const noexcept { return m_size; }
+
+	frame_ring_header const& header() const noexcept { return *m_header; }
+
+  private:
+	void consume(std::stop_token stop);
+
+	// Copies the latest published frame in m_frame. Returns false if there is
+	// no new frame since the last call.
+	bool read_latest_frame();
+
+	std::shared_ptr<drivers::driver> m_driver;
+	// Points into m_driver
+	drivers::capabilities::zone_lighting* m_lighting = nullptr;
+
+	int                m_fd     = -1;
+	std::size_t        m_size   = 0;
+	frame_ring_header* m_header = nullptr;
+	std::uint8_t*      m_slots  = nullptr;
+
+	// The producer can write anything to the header, so the layout is kept
+	// here, and only the sequence is read from the shared memory
+	std::size_t m_frame_size = 0;
+
+	std::chrono::microseconds m_frame_interval;
+	std::uint64_t             m_last_sequence = 0;
+
+	std::vector<drivers::rgb> m_frame;
+	// Zones are empty until we sent them a color at least once
+	std::vector<std::optional<drivers::rgb>> m_applied_frame;
+
+	std::jthread m_consumer;
+};
@@ -0,0 +1,109 @@
+#include "inventory.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+std::string describe_action(drivers::action const& action, std::size_t index)
+{
+	// The index can be used instead of the id to refer to the action
+	return std::string(action.id) + ',' + std::string(action.name) + ',' +
+	       utils::escape_commas(action.description) + ',' +
+	       std::to_string(index);
+}
+
+std::string describe_parameter(drivers::parameter const& param)
+{
+	auto description = std::string(param.name) + ',' +
+	                   utils::escape_commas(param.description) + ',' +
+	                   drivers::parameter::type_to_string(param.type);
+
+	if (param.type == drivers::parameter::uint) {
+		description += ',';
+		description += std::to_string(param.type_info.uint.min);
+		description += ',';
+		description += std::to_string(param.type_info.uint.max);
+	}
+
+	if (param.type == drivers::parameter::enum_) {
+		for (auto const& value : param.type_info.enum_.values) {
+			description += ',';
+			description += utils::escape_commas(value);
+		}
+	}
+
+	return description;
+}
+
+std::shared_ptr<std::string const> inventory::describe(
+    drivers::identifiable_driver_map const& drivers)
+{
+	std::lock_guard lock(m_mutex);
+
+	if (m_description) return m_description;
+
+	// Same order every time, whatever the order of the map
+	std::vector<std::pair<usb::address, drivers::driver const*>> sorted;
+	for (auto const& [address, driver] : drivers)
+		sorted.push_back({address, driver.get()});
+
+	std::sort(sorted.begin(), sorted.end(), [](auto const& a, auto const& b) {
+		return std::pair(a.first.bus, a.first.device) <
+		       std::pair(b.first.bus, b.first.device);
+	});
+
+	std::string description;
+	for (auto const& [address, driver] : sorted) {
+		description += "device," + address.stringify() + ',' +
+		               utils::escape_commas(driver->name()) + ',' +
+		               driver->config_id() + '\n';
+		description += get_schema(*driver).description;
+	}
+
+	m_description = std::make_shared<std::string const>(description);
+	return m_description;
+}
+
+void inventory::invalidate() noexcept
+{
+	std::lock_guard lock(m_mutex);
+	m_description.reset();
+}
+
+std::string inventory::etag(drivers::driver const& driver)
+{
+	std::lock_guard lock(m_mutex);
+	return get_schema(driver).etag;
+}
+
+inventory::schema const& inventory::get_schema(drivers::driver const& driver)
+{
+	auto const [type, inserted] =
+	    m_driver_types.try_emplace(driver.config_id());
+	auto& rendered = type->second;
+	if (!inserted) return rendered;
+
+	auto const actions = driver.get_actions();
+	for (std::size_t i = 0; i < actions.size(); ++i) {
+		rendered.description +=
+		    "action," + describe_action(actions[i], i) + '\n';
+
+		for (auto const& param : actions[i].parameters)
+			rendered.description += "param," + describe_parameter(param) + '\n';
+	}
+
+	// FNV-1a, any change to what clients see changes the hash
+	std::uint64_t hash = 14695981039346656037u;
+	for (auto const chr : rendered.description) {
+		hash ^= static_cast<std::uint8_t>(chr);
+		hash *= 1099511628211u;
+	}
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	rendered.etag = hex;
+
+	return rendered;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "drivers/driver.hpp"
+#include "drivers/manager.hpp"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A line of list-actions: <id>,<name>,<description>,<index>
+std::string describe_action(drivers::action const& action, std::size_t index);
+
+// A line of list-action-params: <name>,<description>,<type>[,...type info]
+std::string describe_parameter(drivers::parameter const& param);
+
+// Everything a client needs to know about the devices, in one response, for
+// describe-all.
+//
+// Actions are the same for every device of a driver type, so they're only
+// rendered (and hashed) once per type. The whole response is kept until the
+// list of devices changes.
+class inventory
+{
+  public:
+	std::shared_ptr<std::string const> describe(
+	    drivers::identifiable_driver_map const& drivers);
+
+	// Must be called when the list of devices changes
+	void invalidate() noexcept;
+
+	// Hash of the driver type's actions and parameters, as 16 hex digits.
+	// Clients can keep the actions they got, and only ask for them again
+	// when this changes (see list-actions-if-changed).
+	std::string etag(drivers::driver const& driver);
+
+  private:
+	struct schema {
+		// The actions of a driver type, with their parameters
+		std::string description;
+		std::string etag;
+	};
+
+	// The lock must be held
+	schema const& get_schema(drivers::driver const& driver);
+
+	std::mutex m_mutex;
+
+	// By config_id. Never invalidated, action tables don't change.
+	std::unordered_map<std::string, schema> m_driver_types;
+
+	// Rendered with the lock held, so invalidate() can't happen halfway
+	// through
+	std::shared_ptr<std::string const> m_description;
+};
@@ -0,0 +1,215 @@
+#include "logger.hpp"
+#include "compile_config.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <syslog.h>
+
+logger::logger() noexcept
+{
+	for (std::size_t i = 0; i < slot_count; ++i)
+		m_slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+logger::~logger() noexcept
+{
+	if (!m_writer.joinable()) return;
+
+	m_writer.request_stop();
+	++m_pushed;
+	m_pushed.notify_one();
+	m_writer.join();
+}
+
+void logger::push(
+    utils::daemon::log_level                        level,
+    std::string_view                                message,
+    std::initializer_list<utils::daemon::log_field> fields) noexcept
+{
+	if (level > m_level.load(std::memory_order_relaxed)) return;
+
+	auto const suppressed = count_repeat(message);
+	if (!suppressed.has_value()) return;
+
+	// Until the writer runs, whoever logs writes
+	if (!m_started.load(std::memory_order_acquire)) {
+		char text[message_size];
+		write(level,
+		      {text, format(text, message, fields, suppressed.value())});
+		return;
+	}
+
+	auto position = m_push_position.load(std::memory_order_relaxed);
+	slot* target  = nullptr;
+
+	while (!target) {
+		auto& candidate = m_slots[position % slot_count];
+		auto const sequence =
+		    candidate.sequence.load(std::memory_order_acquire);
+
+		if (sequence == position) {
+			// Free, try to take it
+			if (m_push_position.compare_exchange_weak(
+			        position, position + 1, std::memory_order_relaxed))
+				target = &candidate;
+		} else if (sequence < position) {
+			// Still holding a message from the previous turn: it's full
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			// Another thread took it
+			position = m_push_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	target->level = level;
+	target->length =
+	    format(target->text, message, fields, suppressed.value());
+	target->sequence.store(position + 1, std::memory_order_release);
+
+	m_pushed.fetch_add(1, std::memory_order_release);
+	m_pushed.notify_one();
+}
+
+void logger::start()
+{
+	if (m_started.exchange(true)) return;
+
+	m_writer = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+void logger::flush() noexcept
+{
+	std::lock_guard lock(m_drain_mutex);
+	drain();
+}
+
+std::optional<std::uint32_t> logger::count_repeat(
+    std::string_view message) noexcept
+{
+	auto const hash    = std::hash<std::string_view>{}(message);
+	auto&      counter = m_repeats[hash % m_repeats.size()];
+
+	auto const now = std::chrono::duration_cast<std::chrono::seconds>(
+	                     std::chrono::steady_clock::now().time_since_epoch())
+	                     .count();
+
+	// Another message, or a new second: start counting again. Racing threads
+	// can make the count a bit off, which is fine for a limit.
+	auto second = counter.second.load(std::memory_order_relaxed);
+	if (counter.hash.exchange(hash, std::memory_order_relaxed) != hash) {
+		counter.second.store(now, std::memory_order_relaxed);
+		counter.count.store(0, std::memory_order_relaxed);
+		counter.suppressed.store(0, std::memory_order_relaxed);
+	} else if (second != now &&
+	           counter.second.compare_exchange_strong(
+	               second, now, std::memory_order_relaxed)) {
+		counter.count.store(0, std::memory_order_relaxed);
+	}
+
+	auto const count = counter.count.fetch_add(1, std::memory_order_relaxed);
+	if (count >= max_repeats) {
+		counter.suppressed.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	return counter.suppressed.exchange(0, std::memory_order_relaxed);
+}
+
+std::size_t logger::format(
+    char*                                           output,
+    std::string_view                                message,
+    std::initializer_list<utils::daemon::log_field> fields,
+    std::uint32_t                                   suppressed) noexcept
+{
+	// One byte is kept for the terminating null, syslog() wants one
+	std::size_t length = 0;
+	auto const  append = [&](std::string_view text) {
+		auto const size = std::min(text.size(), message_size - 1 - length);
+		std::copy_n(text.data(), size, output + length);
+		length += size;
+	};
+
+	append(message);
+
+	for (auto const& field : fields) {
+		append(" ");
+		append(field.key);
+		append("=");
+
+		// Quoted when it has spaces, so fields can still be told apart
+		auto const quote = field.value.find(' ') != std::string_view::npos;
+		if (quote) append("\"");
+		append(field.value);
+		if (quote) append("\"");
+	}
+
+	if (suppressed > 0) {
+		char count[16];
+		auto const end =
+		    std::to_chars(count, count + sizeof(count), suppressed).ptr;
+
+		append(" (");
+		append({count, static_cast<std::size_t>(end - count)});
+		append(" similar messages suppressed)");
+	}
+
+	output[length] = '\0';
+	return length;
+}
+
+void logger::write(utils::daemon::log_level level,
+                   std::string_view         text) noexcept
+{
+	if constexpr (!compile_config::use_daemon)
+		std::printf(
+		    "syslog: %.*s\n", static_cast<int>(text.size()), text.data());
+	else
+		syslog(level, "%.*s", static_cast<int>(text.size()), text.data());
+}
+
+void logger::drain() noexcept
+{
+	while (true) {
+		auto& next = m_slots[m_drain_position % slot_count];
+		if (next.sequence.load(std::memory_order_acquire) !=
+		    m_drain_position + 1)
+			break;
+
+		write(next.level, {next.text, next.length});
+
+		// Free for the next turn
+		next.sequence.store(m_drain_position + slot_count,
+		                    std::memory_order_release);
+		++m_drain_position;
+	}
+
+	auto const dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0) {
+		char text[message_size];
+		auto const length = std::snprintf(
+		    text,
+		    sizeof(text),
+		    "Logging too fast, %llu messages dropped",
+		    static_cast<unsigned long long>(dropped));
+		write(utils::daemon::log_level::warning,
+		      {text, static_cast<std::size_t>(length)});
+	}
+
+	if constexpr (!compile_config::use_daemon) std::fflush(stdout);
+}
+
+void logger::run(std::stop_token stop)
+{
+	while (true) {
+		// Read before draining, so a push happening during it isn't missed
+		auto const pushed = m_pushed.load(std::memory_order_acquire);
+
+		flush();
+		if (stop.stop_requested()) return;
+
+		m_pushed.wait(pushed, std::memory_order_acquire);
+	}
+}
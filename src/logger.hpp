@@ -0,0 +1,115 @@
+#pragma once
+
+#include "utils.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+// Where utils::daemon::log() sends messages, so logging never makes the
+// thread doing it (the libusb event thread, a client's, ...) wait on syslog
+// or stdout.
+//
+// Messages go through a bounded queue: any thread can push to it without
+// taking a lock, and a single writer thread drains it. When it's full, new
+// messages are dropped (and counted) rather than waited for. Messages are
+// formatted straight into their slot, so pushing doesn't allocate either.
+//
+// Identical messages are rate limited: past max_repeats per second, they're
+// counted instead of logged, and the count is added to the next one.
+class logger
+{
+  public:
+	static constexpr std::size_t   slot_count   = 256;
+	static constexpr std::size_t   message_size = 256;
+	static constexpr std::uint32_t max_repeats  = 10;
+
+	logger() noexcept;
+	~logger() noexcept;
+
+	logger(logger const&)            = delete;
+	logger& operator=(logger const&) = delete;
+
+	void set_level(utils::daemon::log_level level) noexcept
+	{
+		m_level = level;
+	}
+
+	void push(utils::daemon::log_level                        level,
+	          std::string_view                                message,
+	          std::initializer_list<utils::daemon::log_field> fields) noexcept;
+
+	// See utils::daemon::start_log_writer()
+	void start();
+
+	void flush() noexcept;
+
+  private:
+	struct slot {
+		// Which turn of the ring the slot is ready for. Pushed messages are
+		// written when it's their position + 1, then it's moved a turn ahead.
+		std::atomic<std::uint64_t> sequence;
+
+		utils::daemon::log_level level;
+		std::size_t              length;
+		char                     text[message_size];
+	};
+
+	struct repeat_counter {
+		// Of the message being counted
+		std::atomic<std::size_t> hash = 0;
+
+		// Seconds since the steady clock's epoch
+		std::atomic<std::int64_t>  second     = -1;
+		std::atomic<std::uint32_t> count      = 0;
+		std::atomic<std::uint32_t> suppressed = 0;
+	};
+
+	// How many messages like this one were suppressed since the last one
+	// logged, or nothing if this one must be suppressed too
+	std::optional<std::uint32_t> count_repeat(
+	    std::string_view message) noexcept;
+
+	// Writes as much as fits, and returns the length
+	static std::size_t format(
+	    char*                                           output,
+	    std::string_view                                message,
+	    std::initializer_list<utils::daemon::log_field> fields,
+	    std::uint32_t                                   suppressed) noexcept;
+
+	static void write(utils::daemon::log_level level,
+	                  std::string_view         text) noexcept;
+
+	// Writes what's queued. The drain mutex must be held.
+	void drain() noexcept;
+
+	void run(std::stop_token stop);
+
+	std::atomic<utils::daemon::log_level> m_level =
+	    utils::daemon::log_level::notice;
+
+	std::array<slot, slot_count> m_slots;
+	std::atomic<std::uint64_t>   m_push_position = 0;
+	std::atomic<std::uint64_t>   m_dropped       = 0;
+
+	// Bumped after each push, the writer waits on it
+	std::atomic<std::uint32_t> m_pushed = 0;
+
+	// Only the writer and flush() read from the ring
+	std::mutex    m_drain_mutex;
+	std::uint64_t m_drain_position = 0;
+
+	// Messages are hashed to a counter. When another message takes it over,
+	// counting starts again.
+	std::array<repeat_counter, 64> m_repeats;
+
+	std::atomic<bool> m_started = false;
+
+	// Declared last, so it's stopped before anything it uses is destroyed
+	std::jthread m_writer;
+};
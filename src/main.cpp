@@ -1,48 +1,262 @@
 #include "config.hpp"
+#include "drivers/capabilities.hpp"
 #include "drivers/driver.hpp"
 #include "drivers/manager.hpp"
 #include "drivers/steelseries/aerox_3_wireless.hpp"
 #include "drivers/steelseries/apex_100.hpp"
 #include "drivers/steelseries/rival_3_wireless.hpp"
+#include "frame_ring.hpp"
+#include "inventory.hpp"
+#include "metrics.hpp"
+#include "notifications.hpp"
+#include "status_poller.hpp"
 #include "unix_socket.hpp"
 #include "usb/context.hpp"
 #include "usb/device.hpp"
 #include "usb/device_manager.hpp"
 #include "utils.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
 // TODO: Make this user-definable!
 constexpr auto SOCKET_PATH = "/var/run/openfdd.socket";
+constexpr auto PID_PATH    = "/run/openfdd.pid";
+
+// How long an old daemon gets to exit before being killed for good
+constexpr auto STOP_TIMEOUT = std::chrono::seconds(5);
 
 enum command_result {
 	success,
 	failure,
+	// Succeeded, but will only reach the device once it wakes up
+	queued,
 };
 
 typedef std::function<command_result(
     std::shared_ptr<socket_connection>      connection,
     drivers::identifiable_driver_map const& drivers,
-    std::vector<std::string>                argv)>
+    std::span<std::string_view const>       argv)>
 
     socket_command_handler;
 
-std::unordered_map<std::string, socket_command_handler>
-get_socket_command_handlers()
+// A command's handler, with its metrics, found in the registry once
+struct socket_command {
+	socket_command_handler run;
+
+	metrics::histogram* duration = nullptr;
+	metrics::counter*   failures = nullptr;
+};
+
+typedef std::unordered_map<std::string,
+                           socket_command,
+                           utils::string_hash,
+                           std::equal_to<>>
+    socket_command_handler_map;
+
+// Finds the drivers matching a selector, which is either "all",
+// "type=<config_id>", or a list of identifiers separated by ';'
+drivers::identifiable_driver_map select_drivers(
+    std::string_view selector, drivers::identifiable_driver_map const& drivers)
+{
+	if (selector == "all") return drivers;
+
+	drivers::identifiable_driver_map selected;
+
+	if (selector.starts_with("type=")) {
+		auto const config_id = selector.substr(5);
+		for (auto const& [id, driver] : drivers)
+			if (driver->config_id() == config_id) selected.insert({id, driver});
+		return selected;
+	}
+
+	for (auto const& identifier : utils::tokenize_view(selector, ';')) {
+		auto const id     = usb::address::from(identifier);
+		auto const driver = drivers.find(id);
+		if (driver == drivers.end())
+			throw std::runtime_error("Driver not found (got: " +
+			                         std::string(identifier) + ")");
+		selected.insert(*driver);
+	}
+
+	return selected;
+}
+
+// Runs the operation on every driver, each on its own thread, so this takes as
+// long as the slowest device, not as long as all of them together. Sends one
+// result line per driver.
+void run_on_each_driver(
+    std::shared_ptr<socket_connection> const&                 connection,
+    drivers::identifiable_driver_map const&                   selected,
+    std::function<drivers::delivery(drivers::driver&)> const& operation)
+{
+	std::vector<std::future<std::string>> results;
+	for (auto const& [id, driver] : selected) {
+		results.push_back(std::async(
+		    std::launch::async, [&operation, id, driver]() -> std::string {
+			    auto const address = id.stringify();
+			    try {
+				    auto const delivery = operation(*driver);
+				    return address + (delivery == drivers::queued
+				                          ? ",queued\n"
+				                          : ",done\n");
+			    } catch (std::runtime_error const& e) {
+				    return address + ",fail," + utils::escape_commas(e.what()) +
+				           '\n';
+			    }
+		    }));
+	}
+
+	for (auto& result : results)
+		connection->write_string(result.get());
+}
+
+struct capability_operation {
+	std::function<bool(drivers::driver&)>              is_supported_by;
+	std::function<drivers::delivery(drivers::driver&)> apply;
+};
+
+template <typename capability>
+capability_operation with_capability(
+    std::function<drivers::delivery(capability&)> apply)
+{
+	using drivers::capabilities::get;
+
+	return {
+	    .is_supported_by =
+	        [](drivers::driver& target) {
+		        return get<capability>(target) != nullptr;
+	        },
+	    .apply = [apply](drivers::driver& target) {
+		    target.initialize();
+
+		    auto const lock = target.lock();
+		    return apply(*get<capability>(target));
+	    },
+	};
+}
+
+// Parses the values given to capability-apply, into the operation to run on
+// each device
+capability_operation parse_capability_operation(
+    std::string_view capability_name, std::span<std::string_view const> values)
+{
+	namespace capabilities = drivers::capabilities;
+
+	auto const check_value_count = [&](std::size_t min, std::size_t max) {
+		if (values.size() < min || values.size() > max)
+			throw std::runtime_error("Wrong number of values for " +
+			                         std::string(capability_name));
+	};
+
+	if (capability_name == "dpi-profiles") {
+		check_value_count(1, 5);
+
+		std::vector<std::uint16_t> dpis;
+		for (auto const& value : values)
+			dpis.push_back(utils::parse_number<std::uint16_t>(
+			    value, {.min = 100, .max = 18'000}, "DPI"));
+
+		return with_capability<capabilities::dpi_table>(
+		    [dpis](auto& target) { return target.apply_dpi_profiles(dpis); });
+	}
+
+	if (capability_name == "active-dpi-profile") {
+		check_value_count(1, 1);
+		auto const profile = utils::parse_number<std::uint8_t>(
+		    values[0], {.min = 1, .max = 5}, "Profile");
+
+		return with_capability<capabilities::dpi_table>(
+		    [profile](auto& target) {
+			    return target.apply_active_dpi_profile(profile);
+		    });
+	}
+
+	if (capability_name == "lighting-color") {
+		check_value_count(1, 1);
+		drivers::parameter const color_parameter{
+		    .type        = drivers::parameter::rgb_color,
+		    .name        = "Color",
+		    .description = "The color to set every zone to",
+		};
+		auto const color =
+		    std::get<drivers::rgb>(color_parameter.parse(values[0]));
+
+		return with_capability<capabilities::zone_lighting>(
+		    [color](auto& target) {
+			    return target.apply_lighting_color(color);
+		    });
+	}
+
+	if (capability_name == "poll-interval") {
+		check_value_count(1, 1);
+		auto const interval = utils::parse_number<std::uint8_t>(
+		    values[0], {.min = 1, .max = 4}, "Poll interval");
+
+		return with_capability<capabilities::poll_rate>(
+		    [interval](auto& target) {
+			    return target.apply_poll_interval(interval);
+		    });
+	}
+
+	if (capability_name == "sleep-timeout") {
+		check_value_count(1, 1);
+		auto const seconds = utils::parse_number<std::uint32_t>(
+		    values[0], {.min = 0}, "Sleep timeout");
+
+		return with_capability<capabilities::sleep_timeout>(
+		    [seconds](auto& target) {
+			    return target.apply_sleep_timeout(seconds);
+		    });
+	}
+
+	if (capability_name == "save") {
+		check_value_count(0, 0);
+
+		return with_capability<capabilities::onboard_save>(
+		    [](auto& target) { return target.save_to_onboard_memory(); });
+	}
+
+	throw std::runtime_error("No such capability (got: " +
+	                         std::string(capability_name) + ")");
+}
+
+// What the command handlers share with the rest of the daemon
+struct daemon_services {
+	std::shared_ptr<status_poller const> poller;
+	std::shared_ptr<inventory>           devices;
+
+	// The socket clients connect to, given to the next daemon on handover
+	int listening_fd = -1;
+};
+
+socket_command_handler_map get_socket_command_handlers(
+    std::shared_ptr<notifications::subscriber> subscriber,
+    daemon_services const&                     services)
 {
 #define DEFINE_SOCKET_COMMAND(name)                                            \
 	socket_command_handler name =                                              \
-	    [](std::shared_ptr<socket_connection>      connection,                 \
-	       drivers::identifiable_driver_map const& drivers,                    \
-	       std::vector<std::string>                argv) -> command_result
+	    [=](std::shared_ptr<socket_connection>      connection,                \
+	        drivers::identifiable_driver_map const& drivers,                   \
+	        std::span<std::string_view const>       argv) -> command_result
 
 	DEFINE_SOCKET_COMMAND(ping)
 	{
@@ -56,8 +270,18 @@ get_socket_command_handlers()
 	{
 		(void)argv;
 		for (auto const& [id, driver] : drivers)
-			connection->write_string(id.stringify() + "," + driver->name() +
-			                         '\n');
+			connection->write_string(
+			    id.stringify() + "," + driver->name() + ',' +
+			    services.devices->etag(*driver) + '\n');
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(describe_all)
+	{
+		(void)argv;
+
+		// Kept until the next hotplug
+		connection->write_string(*services.devices->describe(drivers));
 		return command_result::success;
 	};
 
@@ -81,10 +305,37 @@ get_socket_command_handlers()
 
 		auto const& driver = drivers.at(driver_id);
 
-		for (auto const& [action_id, action] : driver->get_actions())
-			connection->write_string(action_id + ',' + action.name + ',' +
-			                         utils::escape_commas(action.description) +
-			                         '\n');
+		auto const actions = driver->get_actions();
+		for (std::size_t i = 0; i < actions.size(); ++i)
+			connection->write_string(describe_action(actions[i], i) + '\n');
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(list_actions_if_changed)
+	{
+		if (argv.size() < 3) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const& driver_id = usb::address::from(argv[1]);
+		if (!drivers.contains(driver_id)) {
+			connection->write_string(
+			    "fail,Driver not found (got: " + driver_id.stringify() + ")\n");
+			return command_result::failure;
+		}
+
+		auto const& driver = drivers.at(driver_id);
+
+		// The etag is computed once per driver type, this is only a compare
+		if (services.devices->etag(*driver) == argv[2]) {
+			connection->write_string("not-modified\n");
+			return command_result::success;
+		}
+
+		auto const actions = driver->get_actions();
+		for (std::size_t i = 0; i < actions.size(); ++i)
+			connection->write_string(describe_action(actions[i], i) + '\n');
 		return command_result::success;
 	};
 
@@ -108,30 +359,16 @@ get_socket_command_handlers()
 
 		auto const& driver = drivers.at(driver_id);
 
-		auto const& action_id = argv[2];
-		auto const& actions   = driver->get_actions();
-
-		if (!actions.contains(action_id)) {
+		auto const action_index = driver->find_action(argv[2]);
+		if (!action_index.has_value()) {
 			connection->write_string("fail,Action not found\n");
 			return command_result::failure;
 		}
 
-		auto const& action = actions.at(action_id);
-
-		for (auto const& param : action.parameters) {
-			auto response = param.name + ',' +
-			                utils::escape_commas(param.description) + ',' +
-			                drivers::parameter::type_to_string(param.type);
-
-			if (param.type == drivers::parameter::uint) {
-				response += ',';
-				response += std::to_string(param.type_info.uint.min);
-				response += ',';
-				response += std::to_string(param.type_info.uint.max);
-			}
+		auto const& action = driver->get_actions()[action_index.value()];
 
-			connection->write_string(response + '\n');
-		}
+		for (auto const& param : action.parameters)
+			connection->write_string(describe_parameter(param) + '\n');
 
 		return command_result::success;
 	};
@@ -156,122 +393,801 @@ get_socket_command_handlers()
 
 		auto const& driver = drivers.at(driver_id);
 
-		auto const& action_id = argv[2];
-		auto const& actions   = driver->get_actions();
-
-		if (!actions.contains(action_id)) {
+		auto const action_index = driver->find_action(argv[2]);
+		if (!action_index.has_value()) {
 			connection->write_string("fail,Action not found\n");
 			return command_result::failure;
 		}
 
-		auto const& action = actions.at(action_id);
+		auto const& action = driver->get_actions()[action_index.value()];
 
-		// This checks if there are enough arguements
-		if (argv.size() < action.parameters.size() + 3) {
+		// Arguments are checked against the action's parameters before
+		// anything is sent to the device, so the client can be told what's
+		// wrong
+		drivers::arguments args;
+		try {
+			args = action.parse_arguments(argv.subspan(3));
+		} catch (std::runtime_error const& e) {
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		drivers::delivery delivery;
+		try {
+			delivery = driver->run_action(action_index.value(), args);
+		} catch (std::runtime_error const& e) {
+			// The device didn't take it (see usb::transfer_error)
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		if (delivery == drivers::queued) return command_result::queued;
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(action_run_many)
+	{
+		if (argv.size() < 3) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		drivers::identifiable_driver_map selected;
+		try {
+			selected = select_drivers(argv[1], drivers);
+		} catch (std::runtime_error const& e) {
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		auto const action_id = argv[2];
+		auto const params    = argv.subspan(3);
+
+		run_on_each_driver(
+		    connection, selected, [action_id, params](drivers::driver& driver) {
+			    auto const index = driver.find_action(action_id);
+			    if (!index.has_value())
+				    throw std::runtime_error("Action not found");
+
+			    return driver.run_action(index.value(), params);
+		    });
+
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(capability_apply)
+	{
+		if (argv.size() < 3) {
 			connection->write_string("fail,Not enough arguements\n");
 			return command_result::failure;
 		}
 
-		std::vector<std::string> action_params(argv.begin() + 3, argv.end());
+		// The values are parsed once, not once per device
+		drivers::identifiable_driver_map selected;
+		capability_operation             operation;
+		try {
+			selected  = select_drivers(argv[1], drivers);
+			operation = parse_capability_operation(argv[2], argv.subspan(3));
+		} catch (std::runtime_error const& e) {
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		std::erase_if(selected, [&operation](auto const& entry) {
+			return !operation.is_supported_by(*entry.second);
+		});
+
+		if (selected.empty()) {
+			connection->write_string("fail,No device has this capability\n");
+			return command_result::failure;
+		}
 
-		driver->run_action(action_id, action_params);
+		run_on_each_driver(connection, selected, operation.apply);
 
 		return command_result::success;
 	};
 
+	DEFINE_SOCKET_COMMAND(frame_ring_open)
+	{
+		if (argv.size() < 3) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const& driver_id = usb::address::from(argv[1]);
+		if (!drivers.contains(driver_id)) {
+			connection->write_string(
+			    "fail,Driver not found (got: " + driver_id.stringify() + ")\n");
+			return command_result::failure;
+		}
+
+		auto const& driver = drivers.at(driver_id);
+
+		using drivers::capabilities::zone_lighting;
+		if (!drivers::capabilities::get<zone_lighting>(*driver)) {
+			connection->write_string("fail,Device has no lighting zones\n");
+			return command_result::failure;
+		}
+
+		auto const fps = utils::parse_number<std::uint32_t>(
+		    argv[2], {.min = 1, .max = frame_ring::max_fps}, "FPS");
+
+		try {
+			driver->initialize();
+		} catch (std::runtime_error const& e) {
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		auto const ring = std::make_shared<frame_ring>(driver, fps);
+
+		auto const& header = ring->header();
+		connection->write_string_with_fd(
+		    "frame-ring," + std::to_string(header.zone_count) + ',' +
+		        std::to_string(header.slot_count) + ',' +
+		        std::to_string(header.frame_size) + ',' +
+		        std::to_string(ring->size()) + '\n',
+		    ring->fd());
+
+		// The ring stops when the client disconnects
+		connection->bind_resource(ring);
+
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(get_state)
+	{
+		if (argv.size() < 2) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const& driver_id = usb::address::from(argv[1]);
+		if (!drivers.contains(driver_id)) {
+			connection->write_string(
+			    "fail,Driver not found (got: " + driver_id.stringify() + ")\n");
+			return command_result::failure;
+		}
+
+		// Only rendered again after a setting changed
+		try {
+			connection->write_string(*drivers.at(driver_id)->get_state());
+		} catch (std::runtime_error const& e) {
+			// The device couldn't be opened, or its config loaded
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(get_status)
+	{
+		if (argv.size() < 2) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const& driver_id = usb::address::from(argv[1]);
+		if (!drivers.contains(driver_id)) {
+			connection->write_string(
+			    "fail,Driver not found (got: " + driver_id.stringify() + ")\n");
+			return command_result::failure;
+		}
+
+		// Answered from the poller's cache, the device isn't asked anything
+		auto const status = services.poller->get_status(driver_id);
+		if (!status.has_value()) {
+			connection->write_string("fail,Device doesn't report its status\n");
+			return command_result::failure;
+		}
+
+		std::string response =
+		    drivers.at(driver_id)->is_asleep() ? "asleep," : "awake,";
+
+		if (status->battery.has_value()) {
+			auto const age =
+			    std::chrono::duration_cast<std::chrono::seconds>(
+			        std::chrono::steady_clock::now() - status->updated_at);
+
+			response += std::to_string(status->battery.value()) + ',' +
+			            (status->charging ? "charging," : "discharging,") +
+			            std::to_string(age.count());
+		} else {
+			response += "unknown,unknown,unknown";
+		}
+
+		connection->write_string(response + '\n');
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(stats)
+	{
+		(void)drivers;
+		(void)argv;
+		connection->write_string(metrics::render_stats());
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(handover)
+	{
+		(void)drivers;
+		(void)argv;
+
+		// Whoever gets the socket answers every client from then on, so only
+		// root or the user we run as may take it (the socket itself can be
+		// connected to by anyone)
+		auto const uid = connection->peer_uid();
+		if (!uid.has_value() || (*uid != 0 && *uid != geteuid())) {
+			utils::daemon::log("Refused a handover to another user",
+			                   utils::daemon::log_level::warning);
+			connection->write_string("fail,Not allowed\n");
+			return command_result::failure;
+		}
+
+		// The new daemon accepts clients on the socket as soon as it gets
+		// it, while we still do, so there's never a moment without anyone
+		// listening
+		connection->write_string_with_fd("handover\n", services.listening_fd);
+
+		// Device configs are saved on every change, the new daemon reads
+		// them from disk. We just need to stay until it's up.
+		auto const answer = connection->read_line();
+		if (answer.connection_is_over) {
+			utils::daemon::log("Handover aborted, the new daemon went away",
+			                   utils::daemon::log_level::error);
+			return command_result::failure;
+		}
+
+		if (answer.data != "ready") {
+			connection->write_string("fail,Expected ready\n");
+			return command_result::failure;
+		}
+
+		utils::daemon::log("Handed over to the new daemon, exiting");
+		utils::daemon::flush_log();
+
+		// Don't run destructors, the other threads are still using what
+		// they'd destroy
+		std::_Exit(EXIT_SUCCESS);
+	};
+
+	DEFINE_SOCKET_COMMAND(subscribe_events)
+	{
+		if (argv.size() < 2) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const& driver_id = usb::address::from(argv[1]);
+		if (!drivers.contains(driver_id)) {
+			connection->write_string(
+			    "fail,Driver not found (got: " + driver_id.stringify() + ")\n");
+			return command_result::failure;
+		}
+
+		auto const& driver = drivers.at(driver_id);
+
+		if (!driver->get_event_source().has_value()) {
+			connection->write_string("fail,Device doesn't report events\n");
+			return command_result::failure;
+		}
+
+		// Events are only read once the driver is initialized
+		try {
+			driver->initialize();
+		} catch (std::runtime_error const& e) {
+			connection->write_string(
+			    "fail," + utils::escape_commas(e.what()) + '\n');
+			return command_result::failure;
+		}
+
+		// The events of every device go through the hub already, the
+		// subscriber just needs to let this one through
+		subscriber->follow_device(driver_id.stringify());
+
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(subscribe)
+	{
+		(void)drivers;
+
+		if (argv.size() < 2) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const topic = notifications::topic_from_string(argv[1]);
+		if (!topic.has_value()) {
+			connection->write_string("fail,No such topic\n");
+			return command_result::failure;
+		}
+
+		if (argv.size() >= 3) {
+			if (argv[2] == "drop")
+				subscriber->set_overflow_policy(
+				    notifications::subscriber::drop_oldest);
+			else if (argv[2] == "disconnect")
+				subscriber->set_overflow_policy(
+				    notifications::subscriber::disconnect);
+			else {
+				connection->write_string("fail,No such overflow policy\n");
+				return command_result::failure;
+			}
+		}
+
+		subscriber->subscribe(topic.value());
+		return command_result::success;
+	};
+
+	DEFINE_SOCKET_COMMAND(unsubscribe)
+	{
+		(void)drivers;
+
+		if (argv.size() < 2) {
+			connection->write_string("fail,Not enough arguements\n");
+			return command_result::failure;
+		}
+
+		auto const topic = notifications::topic_from_string(argv[1]);
+		if (!topic.has_value()) {
+			connection->write_string("fail,No such topic\n");
+			return command_result::failure;
+		}
+
+		subscriber->unsubscribe(topic.value());
+		return command_result::success;
+	};
+
 #undef DEFINE_SOCKET_COMMAND
 
-	return {
-	    {              "ping",               ping},
-	    {      "list-devices",       list_devices},
-	    {      "list-actions",       list_actions},
-	    {"list-action-params", list_action_params},
-	    {        "action-run",         action_run},
+	socket_command_handler_map handlers = {
+	    {                   "ping",                    {ping}},
+	    {           "list-devices",            {list_devices}},
+	    {           "list-actions",            {list_actions}},
+	    {"list-actions-if-changed", {list_actions_if_changed}},
+	    {     "list-action-params",      {list_action_params}},
+	    {           "describe-all",            {describe_all}},
+	    {             "action-run",              {action_run}},
+	    {        "action-run-many",         {action_run_many}},
+	    {       "capability-apply",        {capability_apply}},
+	    {        "frame-ring-open",         {frame_ring_open}},
+	    {               "handover",                {handover}},
+	    {              "get-state",               {get_state}},
+	    {             "get-status",              {get_status}},
+	    {                  "stats",                   {stats}},
+	    {       "subscribe-events",        {subscribe_events}},
+	    {              "subscribe",               {subscribe}},
+	    {            "unsubscribe",             {unsubscribe}},
 	};
+
+	// Only known commands are counted, so a client can't make up metrics
+	for (auto& [name, command] : handlers) {
+		command.duration = &metrics::get_histogram(
+		    "openfdd_command_duration_seconds", {{"command", name}});
+		command.failures = &metrics::get_counter(
+		    "openfdd_command_failures_total", {{"command", name}});
+	}
+
+	return handlers;
 }
 
-void handle_socket_connection(std::shared_ptr<socket_connection> connection,
-                              drivers::identifiable_driver_map const& drivers)
+void handle_socket_connection(
+    std::shared_ptr<socket_connection>         connection,
+    std::shared_ptr<notifications::subscriber> subscriber,
+    daemon_services const&                     services,
+    drivers::identifiable_driver_map const&    drivers)
 {
-	utils::daemon::log("New connection");
+	utils::daemon::log("New connection", utils::daemon::log_level::debug);
 
 	connection->write_string("openfdd\n");
+	connection->flush();
+
+	auto const& command_handlers =
+	    get_socket_command_handlers(subscriber, services);
 
 	while (true) {
-		auto const& read_result = connection->read_line();
+		auto read_result = connection->read_line();
 
 		if (read_result.connection_is_over) return;
 
-		auto const& input = read_result.data;
-		auto const& input_argv =
-		    utils::split(input, ','); // TODO: Better parsing
+		// The arguments point into read_result.data, no copy is made
+		auto const input_argv = utils::tokenize(read_result.data, ',');
 
 		auto const& command = input_argv[0];
+		auto const  handler = command_handlers.find(command);
 
-		auto const& command_handlers = get_socket_command_handlers();
-
-		if (!command_handlers.contains(command)) {
+		if (handler == command_handlers.end()) {
 			connection->write_string("fail,No such command\n");
+			connection->flush();
 			continue;
 		}
 
-		if (command_handlers.at(command)(connection, drivers, input_argv) ==
-		    command_result::success)
+		command_result result;
+		{
+			metrics::scoped_timer timer(*handler->second.duration);
+			result = handler->second.run(connection, drivers, input_argv);
+		}
+
+		switch (result) {
+		case command_result::success:
 			connection->write_string("done\n");
+			break;
+		case command_result::queued:
+			connection->write_string("queued\n");
+			break;
+		case command_result::failure:
+			handler->second.failures->add();
+			break;
+		}
+
+		// The whole response goes out at once
+		connection->flush();
+	}
+}
+
+// A daemon handing its socket over to us
+struct previous_daemon {
+	// Where to tell it we're ready
+	std::shared_ptr<socket_connection> connection;
+	int                                listening_fd;
+};
+
+// Asks the running daemon for its socket. Returns nothing if there's no
+// daemon, or if it can't hand over (ex. it's an older version).
+std::optional<previous_daemon> request_handover()
+{
+	try {
+		auto const connection = socket_connection::connect(SOCKET_PATH);
+
+		if (connection->read_line().data != "openfdd") return {};
+
+		connection->write_string("handover\n");
+		connection->flush();
+
+		auto const answer = connection->read_line_with_fd();
+		if (answer.data != "handover" || answer.fd < 0) return {};
+
+		return previous_daemon{connection, answer.fd};
+	} catch (std::runtime_error const&) {
+		return {};
+	}
+}
+
+// Whether something still accepts connections on the socket. Daemons from
+// before the PID file don't take its lock, so holding it isn't enough to
+// know the socket is stale.
+bool socket_is_in_use()
+{
+	try {
+		socket_connection::connect(SOCKET_PATH);
+		return true;
+	} catch (std::runtime_error const&) {
+		return false;
+	}
+}
+
+// Where the daemon gets its listening socket from, and when it goes away
+struct daemon_options {
+	// Hands its socket over to us (--replace)
+	std::optional<previous_daemon> previous;
+
+	// Passed by the service manager, which started us on demand
+	std::optional<int> activated_socket;
+
+	// Exit once no client was connected for that long (--idle-exit)
+	std::optional<std::chrono::seconds> idle_timeout;
+
+	// Where to write the metrics for Prometheus (--metrics-file)
+	std::optional<std::string> metrics_file;
+};
+
+// How often the metrics file is written
+constexpr auto METRICS_INTERVAL = std::chrono::seconds(15);
+
+void write_metrics_periodically(std::stop_token stop, std::string const& path)
+{
+	std::mutex                  mutex;
+	std::condition_variable_any wakeup;
+
+	while (!stop.stop_requested()) {
+		try {
+			metrics::write_prometheus(path);
+		} catch (std::exception const& e) {
+			utils::daemon::log("Couldn't write the metrics",
+			                   {{"error", e.what()}},
+			                   utils::daemon::log_level::error);
+		}
+
+		std::unique_lock lock(mutex);
+		wakeup.wait_for(lock, stop, METRICS_INTERVAL, []() { return false; });
 	}
 }
 
-void daemon_main()
+void daemon_main(utils::daemon::pid_file& pid, daemon_options const& options)
 {
-	utils::daemon::become();
+	auto const& previous = options.previous;
+
+	// The service manager keeps track of us, forking would lose it
+	if (!options.activated_socket.has_value()) utils::daemon::become();
+	utils::daemon::start_log_writer();
 
 	usb::context        ctx;
 	usb::device_manager dev_manager(ctx);
 	drivers::manager    drv_manager(dev_manager);
 
-	auto drivers = drv_manager.create_drivers_for_available_devices();
+	notifications::hub hub;
+
+	drivers::identifiable_driver_map drivers;
+
+	// Forwards the events of every device to the hub. Subscriptions are
+	// re-created when the list of drivers changes.
+	std::unordered_map<usb::address, std::shared_ptr<void>> event_subscriptions;
+	auto const forward_events = [&hub, &event_subscriptions](
+	                                auto const& driver_list) {
+		event_subscriptions.clear();
+
+		for (auto const& [id, driver] : driver_list) {
+			auto const address = id.stringify();
 
-	// TODO: Handle disconects! VERY IMPORTANT -> MEMORY LEAK!!
-	std::vector<std::shared_ptr<socket_connection>> connections;
+			event_subscriptions[id] = driver->events().subscribe(
+			    [&hub, address](drivers::device_event const& event) {
+				    hub.publish({
+				        .topic = notifications::device_events,
+				        .key   = address + ',' +
+				               drivers::device_event::type_to_string(event.type),
+				        .data = "notify,event," + address + ',' +
+				                event.stringify() + '\n',
+				        .device = address,
+				    });
+			    });
+		}
+	};
+
+	auto const poller  = std::make_shared<status_poller>();
+	auto const devices = std::make_shared<inventory>();
+
+	std::jthread metrics_writer;
+	if (options.metrics_file.has_value())
+		metrics_writer = std::jthread(
+		    write_metrics_periodically, *options.metrics_file);
+
+	std::mutex drivers_mutex;
+	bool       devices_found = false;
+
+	auto const set_drivers = [&](auto const& new_driver_list) {
+		drivers = new_driver_list;
+		forward_events(drivers);
+		poller->set_drivers(drivers);
+		devices->invalidate();
+	};
+
+	// Devices are only opened once someone needs them: the first client, or
+	// a device being plugged in. Until then, the daemon costs nothing.
+	auto const find_devices = [&]() {
+		std::lock_guard lock(drivers_mutex);
+		if (devices_found) return;
+
+		set_drivers(drv_manager.create_drivers_for_available_devices());
+		devices_found = true;
+	};
+
+	drv_manager.on_config_updated([&hub](std::string const& config_id) {
+		hub.publish({
+		    .topic = notifications::config,
+		    .key   = config_id,
+		    .data  = "notify,config," + config_id + '\n',
+		});
+	});
 
+	// Runs on the USB event thread, so this must only enqueue notifications
 	drv_manager.start_hotplug_support(
-	    [&drivers, &connections](auto new_driver_list) {
-		    drivers = new_driver_list;
-
-		    for (auto const& connection : connections) {
-			    // TODO: This is a hack, need to remove closed connection
-			    if (!connection->opened()) continue;
-			    // TODO: Find a better/more generic way to do this!
-			    connection->write_string("notify,hotplug\n");
+	    [&hub, &drivers_mutex, &devices_found, &set_drivers](
+	        auto new_driver_list) {
+		    {
+			    std::lock_guard lock(drivers_mutex);
+			    set_drivers(new_driver_list);
+			    devices_found = true;
 		    }
+
+		    hub.publish({
+		        .topic = notifications::hotplug,
+		        .key   = "hotplug",
+		        .data  = "notify,hotplug\n",
+		    });
 	    });
 
 	try {
-		unix_socket socket(SOCKET_PATH);
+		// Unless the previous daemon still runs, we hold the lock already
+		if (!previous.has_value()) pid.write_pid();
+
+		auto socket = previous.has_value()
+		                  ? unix_socket(previous->listening_fd)
+		              : options.activated_socket.has_value()
+		                  ? unix_socket(*options.activated_socket)
+		                  : unix_socket(SOCKET_PATH);
+
+		// The service manager made it listen already
+		if (!options.activated_socket.has_value()) socket.listen();
+
+		daemon_services const services{
+		    .poller       = poller,
+		    .devices      = devices,
+		    .listening_fd = socket.fd(),
+		};
+
+		// Everything is set up, the previous daemon can go
+		if (previous.has_value()) {
+			previous->connection->write_now("ready\n");
+			previous->connection->shutdown();
+		}
 
-		socket.listen();
-		socket.wait_for_connection_and_accept([&drivers,
-		                                       &connections](auto connection) {
+		// The previous daemon exits right after getting "ready"
+		if (previous.has_value()) pid.lock();
+
+		auto const handle_client = [&drivers, &hub, &find_devices, services](
+		                               auto connection) {
 			// TODO: Poor man's error handling, should be changed into a more
 			//       robust solution
 			try {
-				connections.push_back(connection);
-				handle_socket_connection(connection, drivers);
+				find_devices();
+
+				auto const subscriber = hub.add_subscriber(connection);
+
+				// Clients always got hotplug notifications, keep it that way
+				subscriber->subscribe(notifications::hotplug);
+
+				handle_socket_connection(
+				    connection, subscriber, services, drivers);
 			} catch (std::runtime_error& e) {
 				utils::daemon::log(e.what(), utils::daemon::log_level::error);
 			}
-		});
+		};
+
+		socket.wait_for_connection_and_accept(handle_client,
+		                                      options.idle_timeout);
+
+		utils::daemon::log("No clients for a while, exiting");
+
+		// The service manager owns the socket file, and starts us again when
+		// a client connects
+		if (!options.activated_socket.has_value())
+			std::filesystem::remove(SOCKET_PATH);
+
+		// Same as after a handover, other threads still use what the
+		// destructors would destroy
+		utils::daemon::flush_log();
+		std::_Exit(EXIT_SUCCESS);
 	} catch (std::runtime_error const& e) {
 		utils::daemon::exit_error(e.what());
 	}
 }
 
+utils::daemon::log_level parse_log_level(std::string_view name)
+{
+	using utils::daemon::log_level;
+
+	if (name == "error") return log_level::error;
+	if (name == "warning") return log_level::warning;
+	if (name == "notice") return log_level::notice;
+	if (name == "info") return log_level::info;
+	if (name == "debug") return log_level::debug;
+
+	throw std::runtime_error("Unknown log level (got: " + std::string(name) +
+	                         ")");
+}
+
+// Asks the running daemon to exit, the hard way if it takes too long. Returns
+// once we hold the lock.
+void stop_running_daemon(utils::daemon::pid_file& pid)
+{
+	auto const owner = pid.owner();
+	if (owner.has_value()) {
+		std::cout << "Stopping old daemon (PID " << *owner << ")\n";
+		kill(*owner, SIGTERM);
+
+		auto const deadline = std::chrono::steady_clock::now() + STOP_TIMEOUT;
+		while (!pid.try_lock()) {
+			if (std::chrono::steady_clock::now() < deadline) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				continue;
+			}
+
+			kill(*owner, SIGKILL);
+			pid.lock();
+			break;
+		}
+	} else {
+		pid.lock();
+	}
+}
+
 int main(int argc, char** argv)
 {
-	if (argc > 1 && argv[1] == std::string("--replace")) {
-		std::cout << "Killing old daemon\n";
-		utils::kill_all("openfdd");
-		std::filesystem::remove(SOCKET_PATH);
+	auto           status  = false;
+	auto           replace = false;
+	daemon_options options;
+
+	try {
+		for (auto i = 1; i < argc; ++i) {
+			auto const arg = std::string_view(argv[i]);
+
+			if (arg == "--status")
+				status = true;
+			else if (arg == "--replace")
+				replace = true;
+			else if (arg.starts_with("--log-level="))
+				utils::daemon::set_log_level(
+				    parse_log_level(arg.substr(arg.find('=') + 1)));
+			else if (arg.starts_with("--metrics-file="))
+				options.metrics_file = arg.substr(arg.find('=') + 1);
+			else if (arg.starts_with("--idle-exit="))
+				options.idle_timeout = std::chrono::seconds(
+				    utils::parse_number(arg.substr(arg.find('=') + 1),
+				                        {.min = 1},
+				                        "--idle-exit"));
+			else
+				throw std::runtime_error("Unknown option: " +
+				                         std::string(arg));
+		}
+
+		// Before anything else, the variables are only for this process
+		options.activated_socket = get_activated_socket();
+
+		utils::daemon::pid_file pid(PID_PATH);
+
+		if (status) {
+			auto const owner = pid.owner();
+			if (!owner.has_value()) {
+				std::cout << "openfdd isn't running\n";
+				return EXIT_FAILURE;
+			}
+
+			std::cout << "openfdd is running (PID " << *owner << ")\n";
+			return EXIT_SUCCESS;
+		}
+
+		if (replace) {
+			// Take the socket over from the running daemon, so clients can
+			// connect during the whole upgrade
+			options.previous = request_handover();
+
+			if (!options.previous.has_value()) stop_running_daemon(pid);
+		} else if (!pid.try_lock()) {
+			auto const owner = pid.owner();
+			std::cerr << "openfdd is already running"
+			          << (owner.has_value()
+			                  ? " (PID " + std::to_string(*owner) + ")"
+			                  : "")
+			          << ", use --replace to restart it\n";
+			return EXIT_FAILURE;
+		}
+
+		// We hold the lock, so any socket left there belongs to a daemon
+		// that's gone (unless the service manager made it), or to one that
+		// doesn't know about the lock
+		if (!options.previous.has_value() &&
+		    !options.activated_socket.has_value()) {
+			if (socket_is_in_use()) {
+				std::cerr << "Another openfdd (an older version, not using "
+				          << PID_PATH << ") listens on " << SOCKET_PATH
+				          << ", stop it first\n";
+				return EXIT_FAILURE;
+			}
+
+			std::filesystem::remove(SOCKET_PATH);
+		}
+
+		daemon_main(pid, options);
+	} catch (std::runtime_error const& e) {
+		std::cerr << e.what() << '\n';
+		return EXIT_FAILURE;
 	}
-	daemon_main();
 }
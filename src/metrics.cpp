@@ -0,0 +1,289 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace metrics
+{
+
+void histogram::record(std::chrono::nanoseconds duration) noexcept
+{
+	auto const value_us = static_cast<std::uint64_t>(std::max<std::int64_t>(
+	    std::chrono::duration_cast<std::chrono::microseconds>(duration)
+	        .count(),
+	    0));
+
+	m_buckets[bucket_of(value_us)].fetch_add(1, std::memory_order_relaxed);
+	m_sum_us.fetch_add(value_us, std::memory_order_relaxed);
+
+	auto max = m_max_us.load(std::memory_order_relaxed);
+	while (value_us > max &&
+	       !m_max_us.compare_exchange_weak(
+	           max, value_us, std::memory_order_relaxed)) {
+	}
+}
+
+std::uint64_t histogram::count() const noexcept
+{
+	std::uint64_t total = 0;
+	for (auto const& bucket : m_buckets)
+		total += bucket.load(std::memory_order_relaxed);
+	return total;
+}
+
+std::uint64_t histogram::percentile_us(double percentile) const noexcept
+{
+	auto const total = count();
+	if (total == 0) return 0;
+
+	auto const rank = std::max<std::uint64_t>(
+	    static_cast<std::uint64_t>(percentile * total + 0.5), 1);
+
+	std::uint64_t seen = 0;
+	for (std::size_t i = 0; i < bucket_count; ++i) {
+		seen += m_buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank) return std::min(bucket_end(i) - 1, max_us());
+	}
+
+	return max_us();
+}
+
+std::uint64_t histogram::count_below_us(std::uint64_t limit) const noexcept
+{
+	// Powers of two are bucket boundaries, so no bucket is cut in half
+	std::uint64_t total = 0;
+	for (std::size_t i = 0; i < bucket_count && bucket_end(i) <= limit; ++i)
+		total += m_buckets[i].load(std::memory_order_relaxed);
+	return total;
+}
+
+std::size_t histogram::bucket_of(std::uint64_t value_us) noexcept
+{
+	value_us = std::min(value_us, (std::uint64_t(1) << max_exponent) - 1);
+	if (value_us < sub_buckets) return value_us;
+
+	// The 2 bits after the highest one pick the sub-bucket
+	std::size_t const exponent = std::bit_width(value_us) - 1;
+	auto const sub = (value_us >> (exponent - 2)) & (sub_buckets - 1);
+
+	return sub_buckets + (exponent - 2) * sub_buckets + sub;
+}
+
+std::uint64_t histogram::bucket_end(std::size_t bucket) noexcept
+{
+	if (bucket < sub_buckets) return bucket + 1;
+
+	auto const exponent = (bucket - sub_buckets) / sub_buckets + 2;
+	auto const sub      = (bucket - sub_buckets) % sub_buckets;
+
+	return (sub_buckets + sub + 1) << (exponent - 2);
+}
+
+namespace
+{
+
+template <typename metric> struct series {
+	// key=value;key=value, for the stats command
+	std::string stats_labels;
+	metric      value;
+};
+
+// By name, then by labels in the Prometheus format (key="value",...), so the
+// series of a metric are next to each other
+template <typename metric>
+using series_map =
+    std::map<std::pair<std::string, std::string>, series<metric>>;
+
+class registry
+{
+  public:
+	template <typename metric>
+	metric& get(series_map<metric>&         all,
+	            std::string_view             name,
+	            std::initializer_list<label> labels)
+	{
+		std::pair<std::string, std::string> key{name, ""};
+		for (auto const& current : labels) {
+			if (!key.second.empty()) key.second += ',';
+			key.second += current.key;
+			key.second += "=\"";
+			key.second += current.value;
+			key.second += '"';
+		}
+
+		{
+			std::shared_lock lock(m_mutex);
+
+			auto const existing = all.find(key);
+			if (existing != all.end()) return existing->second.value;
+		}
+
+		std::unique_lock lock(m_mutex);
+
+		auto const [added, inserted] = all.try_emplace(key);
+		if (inserted) {
+			for (auto const& current : labels) {
+				auto& stats_labels = added->second.stats_labels;
+				if (!stats_labels.empty()) stats_labels += ';';
+				stats_labels += current.key;
+				stats_labels += '=';
+				stats_labels += current.value;
+			}
+		}
+
+		return added->second.value;
+	}
+
+	std::shared_mutex m_mutex;
+
+	series_map<counter>   m_counters;
+	series_map<histogram> m_histograms;
+};
+
+registry& get_registry()
+{
+	static registry instance;
+	return instance;
+}
+
+// Prometheus wants seconds
+std::string to_seconds(std::uint64_t microseconds)
+{
+	char buffer[32];
+	std::snprintf(buffer,
+	              sizeof(buffer),
+	              "%.6f",
+	              static_cast<double>(microseconds) / 1e6);
+	return buffer;
+}
+
+// Bucket limits for the Prometheus histograms: every power of 4 from 1us
+// to ~17s is enough to see where latencies are, without too many series
+constexpr std::uint64_t prometheus_buckets_us[] = {
+    1,
+    4,
+    16,
+    64,
+    256,
+    1'024,
+    4'096,
+    16'384,
+    65'536,
+    262'144,
+    1'048'576,
+    4'194'304,
+    16'777'216,
+};
+
+std::string with_labels(std::string const& labels, std::string_view extra)
+{
+	if (labels.empty()) return '{' + std::string(extra) + '}';
+	if (extra.empty()) return '{' + labels + '}';
+	return '{' + labels + ',' + std::string(extra) + '}';
+}
+
+} // namespace
+
+counter& get_counter(std::string_view name, std::initializer_list<label> labels)
+{
+	auto& all = get_registry();
+	return all.get(all.m_counters, name, labels);
+}
+
+histogram& get_histogram(std::string_view             name,
+                         std::initializer_list<label> labels)
+{
+	auto& all = get_registry();
+	return all.get(all.m_histograms, name, labels);
+}
+
+std::string render_stats()
+{
+	auto& all = get_registry();
+	std::shared_lock lock(all.m_mutex);
+
+	std::string output;
+
+	for (auto const& [key, current] : all.m_counters)
+		output += "counter," + key.first + ',' + current.stats_labels + ',' +
+		          std::to_string(current.value.value()) + '\n';
+
+	for (auto const& [key, current] : all.m_histograms) {
+		auto const& values = current.value;
+		output += "histogram," + key.first + ',' + current.stats_labels + ',' +
+		          std::to_string(values.count()) + ',' +
+		          std::to_string(values.sum_us()) + ',' +
+		          std::to_string(values.percentile_us(0.5)) + ',' +
+		          std::to_string(values.percentile_us(0.9)) + ',' +
+		          std::to_string(values.percentile_us(0.99)) + ',' +
+		          std::to_string(values.max_us()) + '\n';
+	}
+
+	return output;
+}
+
+std::string render_prometheus()
+{
+	auto& all = get_registry();
+	std::shared_lock lock(all.m_mutex);
+
+	std::string output;
+	std::string family;
+
+	for (auto const& [key, current] : all.m_counters) {
+		if (key.first != family) {
+			family = key.first;
+			output += "# TYPE " + family + " counter\n";
+		}
+
+		output += key.first +
+		          (key.second.empty() ? "" : with_labels(key.second, "")) +
+		          ' ' + std::to_string(current.value.value()) + '\n';
+	}
+
+	for (auto const& [key, current] : all.m_histograms) {
+		if (key.first != family) {
+			family = key.first;
+			output += "# TYPE " + family + " histogram\n";
+		}
+
+		auto const& values = current.value;
+		for (auto const limit : prometheus_buckets_us)
+			output +=
+			    key.first + "_bucket" +
+			    with_labels(key.second, "le=\"" + to_seconds(limit) + '"') +
+			    ' ' + std::to_string(values.count_below_us(limit)) + '\n';
+
+		auto const count = std::to_string(values.count());
+		output += key.first + "_bucket" +
+		          with_labels(key.second, "le=\"+Inf\"") + ' ' + count + '\n';
+		output += key.first + "_sum" +
+		          (key.second.empty() ? "" : with_labels(key.second, "")) +
+		          ' ' + to_seconds(values.sum_us()) + '\n';
+		output += key.first + "_count" +
+		          (key.second.empty() ? "" : with_labels(key.second, "")) +
+		          ' ' + count + '\n';
+	}
+
+	return output;
+}
+
+void write_prometheus(std::string const& path)
+{
+	auto const temporary_path = path + ".tmp";
+	{
+		std::ofstream output(temporary_path);
+		output << render_prometheus();
+		if (!output) throw std::runtime_error("Couldn't write " + path);
+	}
+	std::filesystem::rename(temporary_path, path);
+}
+
+} // namespace metrics
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+// Counters and latency histograms, to see how the daemon behaves under load.
+// They're read with the stats command, and can be written to a file in the
+// Prometheus text format (see --metrics-file).
+//
+// Updating a metric never takes a lock. Finding it by name and labels takes
+// a shared one, so call sites running very often can keep the reference:
+// metrics live as long as the daemon.
+namespace metrics
+{
+
+struct label {
+	std::string_view key;
+	std::string_view value;
+};
+
+class counter
+{
+  public:
+	void add(std::uint64_t amount = 1) noexcept
+	{
+		m_value.fetch_add(amount, std::memory_order_relaxed);
+	}
+
+	std::uint64_t value() const noexcept
+	{
+		return m_value.load(std::memory_order_relaxed);
+	}
+
+  private:
+	std::atomic<std::uint64_t> m_value = 0;
+};
+
+// Durations, in microseconds, in log-linear buckets (like HDR histograms):
+// each power of two is split in 4, so a value is known within 25%, from 1us
+// to hours, with a fixed number of buckets.
+class histogram
+{
+  public:
+	static constexpr std::size_t sub_buckets  = 4;
+	static constexpr std::size_t max_exponent = 40;
+	static constexpr std::size_t bucket_count =
+	    sub_buckets + (max_exponent - 2) * sub_buckets;
+
+	void record(std::chrono::nanoseconds duration) noexcept;
+
+	std::uint64_t count() const noexcept;
+	std::uint64_t sum_us() const noexcept
+	{
+		return m_sum_us.load(std::memory_order_relaxed);
+	}
+	std::uint64_t max_us() const noexcept
+	{
+		return m_max_us.load(std::memory_order_relaxed);
+	}
+
+	// Upper bound of the bucket holding the percentile (from 0 to 1), so
+	// it's never under the real value
+	std::uint64_t percentile_us(double percentile) const noexcept;
+
+	// Number of values under the limit. The limit must be a power of two.
+	std::uint64_t count_below_us(std::uint64_t limit) const noexcept;
+
+	static std::size_t   bucket_of(std::uint64_t value_us) noexcept;
+	static std::uint64_t bucket_end(std::size_t bucket) noexcept;
+
+  private:
+	std::array<std::atomic<std::uint64_t>, bucket_count> m_buckets{};
+	std::atomic<std::uint64_t>                           m_sum_us = 0;
+	std::atomic<std::uint64_t>                           m_max_us = 0;
+};
+
+// Records how long the scope took
+class scoped_timer
+{
+  public:
+	scoped_timer(histogram& target) noexcept
+	    : m_target(target), m_start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~scoped_timer() noexcept
+	{
+		m_target.record(std::chrono::steady_clock::now() - m_start);
+	}
+
+	scoped_timer(scoped_timer const&)            = delete;
+	scoped_timer& operator=(scoped_timer const&) = delete;
+
+  private:
+	histogram&                            m_target;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+// Created the first time they're asked for
+counter&   get_counter(std::string_view             name,
+                       std::initializer_list<label> labels = {});
+histogram& get_histogram(std::string_view             name,
+                         std::initializer_list<label> labels = {});
+
+// For the stats command, one line per metric:
+//  counter,<name>,<labels>,<value>
+//  histogram,<name>,<labels>,<count>,<sum>,<p50>,<p90>,<p99>,<max>
+// Labels are written as key=value;key=value, durations in microseconds.
+std::string render_stats();
+
+// The Prometheus text format. Durations are in seconds, as it expects.
+std::string render_prometheus();
+
+// Writes render_prometheus() to the file. It's replaced as a whole, so
+// readers never see it half-written.
+void write_prometheus(std::string const& path);
+
+} // namespace metrics
@@ -0,0 +1,195 @@
+#include "notifications.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace notifications
+{
+
+std::string const topic_to_string(topic t) noexcept
+{
+	switch (t) {
+	case hotplug:
+		return "hotplug";
+	case device_events:
+		return "events";
+	case config:
+		return "config";
+	}
+	return "unknown";
+}
+
+std::optional<topic> const topic_from_string(std::string_view name) noexcept
+{
+	for (auto const t : {hotplug, device_events, config})
+		if (topic_to_string(t) == name) return t;
+	return {};
+}
+
+subscriber::subscriber(std::shared_ptr<socket_connection> connection)
+    : m_connection(connection)
+{
+	m_writer = std::jthread(
+	    [this](std::stop_token stop) { write_notifications(stop); });
+}
+
+subscriber::~subscriber() noexcept
+{
+	m_writer.request_stop();
+	if (m_writer.joinable()) m_writer.join();
+}
+
+void subscriber::subscribe(topic t) noexcept
+{
+	std::lock_guard lock(m_mutex);
+	m_topics |= 1u << t;
+}
+
+void subscriber::unsubscribe(topic t) noexcept
+{
+	std::lock_guard lock(m_mutex);
+	m_topics &= ~(1u << t);
+}
+
+bool subscriber::is_subscribed(topic t) const noexcept
+{
+	std::lock_guard lock(m_mutex);
+	return m_topics & (1u << t);
+}
+
+void subscriber::follow_device(std::string const& address)
+{
+	std::lock_guard lock(m_mutex);
+	m_devices.insert(address);
+}
+
+bool subscriber::wants(notification const& candidate) const noexcept
+{
+	std::lock_guard lock(m_mutex);
+
+	if (m_topics & (1u << candidate.topic)) return true;
+
+	// Checked here rather than queued separately, so a client following the
+	// device and subscribed to the topic gets the event once
+	return candidate.topic == device_events &&
+	       m_devices.contains(candidate.device);
+}
+
+void subscriber::set_overflow_policy(overflow_policy policy) noexcept
+{
+	std::lock_guard lock(m_mutex);
+	m_overflow_policy = policy;
+}
+
+void subscriber::enqueue(notification const& new_notification)
+{
+	std::lock_guard lock(m_mutex);
+
+	// Coalesce with a notification about the same thing that wasn't sent yet
+	for (auto& queued : m_queue) {
+		if (queued.key == new_notification.key) {
+			queued = new_notification;
+			return;
+		}
+	}
+
+	if (m_queue.size() >= max_queue_size) {
+		if (m_overflow_policy == disconnect) {
+			utils::daemon::log("Disconnecting client too slow to read "
+			                   "notifications");
+			m_connection->shutdown();
+			return;
+		}
+
+		m_queue.pop_front();
+		++m_dropped;
+	}
+
+	m_queue.push_back(new_notification);
+	m_queue_changed.notify_one();
+}
+
+void subscriber::write_notifications(std::stop_token stop)
+{
+	while (true) {
+		std::unique_lock lock(m_mutex);
+
+		auto const has_notifications = m_queue_changed.wait(
+		    lock, stop, [this]() { return !m_queue.empty(); });
+		if (!has_notifications) return; // We were asked to stop
+
+		auto const next    = std::move(m_queue.front());
+		auto const dropped = std::exchange(m_dropped, 0);
+		m_queue.pop_front();
+
+		// Don't hold the lock while writing, the client may be slow, and
+		// publishers shouldn't wait for it
+		lock.unlock();
+
+		try {
+			// Let the client know it missed some, so it can re-sync
+			if (dropped > 0)
+				m_connection->write_now(
+				    "notify,dropped," + std::to_string(dropped) + '\n');
+
+			m_connection->write_now(next.data);
+		} catch (std::runtime_error const& e) {
+			utils::daemon::log(e.what(), utils::daemon::log_level::error);
+			return;
+		}
+	}
+}
+
+std::shared_ptr<subscriber> hub::add_subscriber(
+    std::shared_ptr<socket_connection> connection)
+{
+	auto const new_subscriber = std::make_shared<subscriber>(connection);
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_subscribers.push_back(new_subscriber);
+	}
+
+	// The hub's reference is the one owning the subscriber, the caller's
+	// only removes it from the hub
+	return std::shared_ptr<subscriber>(
+	    new_subscriber.get(),
+	    [this](subscriber* removed) { remove_subscriber(removed); });
+}
+
+void hub::remove_subscriber(subscriber const* removed)
+{
+	std::shared_ptr<subscriber> last_reference;
+
+	{
+		std::lock_guard lock(m_mutex);
+
+		auto const position = std::find_if(
+		    m_subscribers.begin(),
+		    m_subscribers.end(),
+		    [removed](auto const& current_subscriber) {
+			    return current_subscriber.get() == removed;
+		    });
+		if (position == m_subscribers.end()) return;
+
+		last_reference = std::move(*position);
+		m_subscribers.erase(position);
+	}
+
+	// Destroyed here, on the thread that was done with it, and without the
+	// lock, since it waits for its writer thread
+}
+
+void hub::publish(notification const& new_notification)
+{
+	// Subscribers are only used with the lock held, so they can't be
+	// removed meanwhile, and the last reference is never released here
+	std::lock_guard lock(m_mutex);
+
+	for (auto const& current_subscriber : m_subscribers)
+		if (current_subscriber->wants(new_notification))
+			current_subscriber->enqueue(new_notification);
+}
+
+} // namespace notifications
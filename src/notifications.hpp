@@ -0,0 +1,118 @@
+#pragma once
+
+#include "unix_socket.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace notifications
+{
+
+enum topic {
+	hotplug,
+	device_events,
+	config,
+};
+
+std::string const         topic_to_string(topic) noexcept;
+std::optional<topic> const topic_from_string(std::string_view) noexcept;
+
+struct notification {
+	enum topic topic;
+
+	// Notifications with the same key replace each other while they're
+	// waiting to be sent, so a slow client only gets the latest one.
+	std::string key;
+
+	std::string data;
+
+	// Address of the device it's about, if any (see subscriber::follow_device)
+	std::string device = {};
+};
+
+// A client receiving notifications.
+//
+// Notifications are queued, and written to the socket from a dedicated
+// thread, so publishing never blocks on a slow client.
+class subscriber
+{
+  public:
+	// What to do when the queue is full
+	enum overflow_policy {
+		drop_oldest,
+		disconnect,
+	};
+
+	static constexpr std::size_t max_queue_size = 64;
+
+	subscriber(std::shared_ptr<socket_connection> connection);
+	~subscriber() noexcept;
+
+	subscriber(subscriber const&)            = delete;
+	subscriber& operator=(subscriber const&) = delete;
+
+	void subscribe(topic) noexcept;
+	void unsubscribe(topic) noexcept;
+	bool is_subscribed(topic) const noexcept;
+
+	// Receives the events of that device, even if the client didn't subscribe
+	// to the events topic
+	void follow_device(std::string const& address);
+
+	// Whether the client subscribed to the notification's topic, or follows
+	// the device it's about
+	bool wants(notification const&) const noexcept;
+
+	void set_overflow_policy(overflow_policy) noexcept;
+
+	// Queues the notification, whether the client subscribed to its topic or
+	// not. Never blocks.
+	void enqueue(notification const&);
+
+  private:
+	void write_notifications(std::stop_token stop);
+
+	std::shared_ptr<socket_connection> m_connection;
+
+	mutable std::mutex              m_mutex;
+	std::condition_variable_any     m_queue_changed;
+	std::deque<notification>        m_queue;
+	unsigned                        m_topics          = 0;
+	std::unordered_set<std::string> m_devices;
+	overflow_policy                 m_overflow_policy = drop_oldest;
+	std::size_t                     m_dropped         = 0;
+
+	std::jthread m_writer;
+};
+
+// Sends notifications to the subscribers interested in them
+class hub
+{
+  public:
+	// The subscriber is removed from the hub when the returned pointer is
+	// destroyed, and is destroyed on that same thread: the hub doesn't hand
+	// its own references out, so publishing (ex. from the USB thread) never
+	// ends up destroying a subscriber and waiting for its writer thread.
+	std::shared_ptr<subscriber> add_subscriber(
+	    std::shared_ptr<socket_connection> connection);
+
+	// Only enqueues, never writes to sockets. Safe to call from the USB
+	// thread.
+	void publish(notification const&);
+
+  private:
+	void remove_subscriber(subscriber const*);
+
+	std::mutex                               m_mutex;
+	std::vector<std::shared_ptr<subscriber>> m_subscribers;
+};
+
+} // namespace notifications
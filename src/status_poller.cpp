@@ -0,0 +1,261 @@
+#include "status_poller.hpp"
+#include "drivers/capabilities.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+status_poller::status_poller() : m_random(std::random_device{}())
+{
+	m_thread = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+status_poller::~status_poller() noexcept
+{
+	m_thread.request_stop();
+	if (m_thread.joinable()) m_thread.join();
+
+	// Unsubscribing waits for the events being handled, which need the lock,
+	// so don't hold it while destroying the subscriptions
+	device_map devices;
+	{
+		std::lock_guard lock(m_mutex);
+		devices.swap(m_devices);
+	}
+}
+
+void status_poller::set_drivers(
+    drivers::identifiable_driver_map const& driver_list)
+{
+	using drivers::capabilities::battery_status;
+	using drivers::capabilities::get;
+
+	// Same as in the destructor, these are destroyed without the lock
+	std::vector<std::shared_ptr<void>> old_subscriptions;
+
+	std::lock_guard lock(m_mutex);
+
+	for (auto device = m_devices.begin(); device != m_devices.end();) {
+		auto const current = driver_list.find(device->first);
+		if (current != driver_list.end() &&
+		    current->second == device->second.driver) {
+			++device;
+			continue;
+		}
+
+		old_subscriptions.push_back(std::move(device->second.subscription));
+		device = m_devices.erase(device);
+	}
+
+	for (auto const& [address, driver] : driver_list) {
+		if (m_devices.contains(address) || !get<battery_status>(*driver))
+			continue;
+
+		auto& device  = m_devices[address];
+		device.driver = driver;
+		device.subscription =
+		    driver->events().subscribe([this, address](auto const& event) {
+			    on_event(address, event);
+		    });
+
+		// Spread the first polls of devices found at the same time
+		std::uniform_int_distribution<std::int64_t> first_poll(
+		    0, min_interval / tick);
+		schedule(address, device, first_poll(m_random) * tick);
+	}
+}
+
+std::optional<status_poller::status> status_poller::get_status(
+    usb::address const& address) const
+{
+	std::lock_guard lock(m_mutex);
+
+	auto const device = m_devices.find(address);
+	if (device == m_devices.end()) return {};
+
+	return device->second.current;
+}
+
+void status_poller::schedule(usb::address const& address,
+                             tracked_device&     device,
+                             std::chrono::seconds delay)
+{
+	// The wheel doesn't move while it's empty, it starts from now again
+	if (!ticks_until_next_timer().has_value())
+		m_current_slot_time = std::chrono::steady_clock::now();
+
+	// Up to an eighth of the delay is added, so devices polled at the same
+	// time drift apart
+	std::uniform_int_distribution<std::int64_t> jitter(0, delay / tick / 8);
+
+	// The wheel is only moved when the thread wakes up, so it may be behind
+	auto const ticks =
+	    ticks_behind() +
+	    std::max<std::int64_t>(delay / tick + jitter(m_random), 1);
+
+	++device.generation;
+	m_wheel[(m_current_slot + ticks) % slot_count].push_back({
+	    .address    = address,
+	    .generation = device.generation,
+	    .rounds     = static_cast<std::size_t>(ticks - 1) / slot_count,
+	});
+
+	// It may be due before what the thread is waiting for
+	m_new_timer = true;
+	m_timers_changed.notify_one();
+}
+
+std::int64_t status_poller::ticks_behind() const
+{
+	return (std::chrono::steady_clock::now() - m_current_slot_time) / tick;
+}
+
+std::optional<std::int64_t> status_poller::ticks_until_next_timer() const
+{
+	std::optional<std::int64_t> next;
+
+	for (std::size_t offset = 1; offset <= slot_count; ++offset) {
+		for (auto const& current :
+		     m_wheel[(m_current_slot + offset) % slot_count]) {
+			auto const ticks =
+			    static_cast<std::int64_t>(offset + current.rounds * slot_count);
+			if (!next.has_value() || ticks < next.value()) next = ticks;
+		}
+	}
+
+	return next;
+}
+
+std::vector<usb::address> status_poller::advance()
+{
+	std::vector<usb::address> due;
+
+	for (auto behind = ticks_behind(); behind > 0; --behind) {
+		m_current_slot = (m_current_slot + 1) % slot_count;
+		m_current_slot_time += tick;
+
+		std::erase_if(m_wheel[m_current_slot], [&](timer& current) {
+			if (current.rounds > 0) {
+				--current.rounds;
+				return false;
+			}
+
+			auto const device = m_devices.find(current.address);
+			if (device != m_devices.end() &&
+			    device->second.generation == current.generation)
+				due.push_back(current.address);
+			return true;
+		});
+	}
+
+	return due;
+}
+
+void status_poller::on_event(usb::address const&          address,
+                             drivers::device_event const& event)
+{
+	std::lock_guard lock(m_mutex);
+
+	auto const device = m_devices.find(address);
+	if (device == m_devices.end()) return;
+	auto& tracked = device->second;
+
+	switch (event.type) {
+	case drivers::device_event::battery: {
+		// This is the answer to a poll, poll less often while the level
+		// doesn't change
+		auto const changed = tracked.current.battery != event.value ||
+		                     tracked.current.charging != event.charging;
+		tracked.interval = changed
+		                       ? min_interval
+		                       : std::min(tracked.interval * 2, max_interval);
+
+		tracked.current = {
+		    .battery    = event.value,
+		    .charging   = event.charging,
+		    .updated_at = std::chrono::steady_clock::now(),
+		};
+		schedule(address, tracked, tracked.interval);
+		break;
+	}
+	case drivers::device_event::awake:
+		// It wasn't polled while it slept, catch up soon
+		tracked.interval = min_interval;
+		schedule(address, tracked, tick);
+		break;
+	case drivers::device_event::asleep:
+	case drivers::device_event::dpi_profile:
+		break;
+	}
+}
+
+void status_poller::poll(usb::address const& address)
+{
+	std::shared_ptr<drivers::driver> driver;
+	{
+		std::lock_guard lock(m_mutex);
+
+		auto const device = m_devices.find(address);
+		if (device == m_devices.end()) return;
+		driver = device->second.driver;
+
+		// The awake event schedules the next poll
+		if (driver->is_asleep()) {
+			schedule(address, device->second, max_interval);
+			return;
+		}
+	}
+
+	// The answer comes back later, as a battery event
+	try {
+		driver->initialize();
+		drivers::capabilities::get<drivers::capabilities::battery_status>(
+		    *driver)
+		    ->request_battery_status();
+	} catch (std::runtime_error const& e) {
+		utils::daemon::log(
+		    "Couldn't poll the battery",
+		    {{"device", address.stringify()}, {"error", e.what()}},
+		    utils::daemon::log_level::error);
+	}
+
+	std::lock_guard lock(m_mutex);
+
+	auto const device = m_devices.find(address);
+	if (device == m_devices.end()) return;
+
+	// In case no answer comes, the answer replaces it
+	schedule(address, device->second, device->second.interval);
+}
+
+void status_poller::run(std::stop_token stop)
+{
+	auto const new_timer = [this]() {
+		return std::exchange(m_new_timer, false);
+	};
+
+	std::unique_lock lock(m_mutex);
+
+	while (true) {
+		auto const next = ticks_until_next_timer();
+		if (next.has_value()) {
+			auto const deadline = m_current_slot_time + next.value() * tick;
+			m_timers_changed.wait_until(lock, stop, deadline, new_timer);
+		} else {
+			m_timers_changed.wait(lock, stop, new_timer);
+		}
+
+		if (stop.stop_requested()) return;
+
+		auto const due = advance();
+		if (due.empty()) continue;
+
+		// Polls talk to the devices, don't make everyone else wait for them
+		lock.unlock();
+
+		for (auto const& address : due)
+			poll(address);
+
+		lock.lock();
+	}
+}
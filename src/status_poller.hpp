@@ -0,0 +1,120 @@
+#pragma once
+
+#include "drivers/events.hpp"
+#include "drivers/manager.hpp"
+#include "usb/device.hpp"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Keeps the battery level of wireless devices up to date by asking them for
+// it from time to time, and caches it so clients get it right away.
+//
+// Polls are scheduled on a timer wheel with one slot per second. The thread
+// sleeps until the next poll is due, whatever the number of devices, and
+// doesn't wake up at all while no device needs polling. A device whose
+// battery level doesn't change is polled less and less often, and a sleeping
+// device isn't polled until it wakes up. Polls are spread randomly, so
+// devices plugged in at the same time don't all get polled at once.
+class status_poller
+{
+  public:
+	struct status {
+		// Percentage, if the device reported it yet
+		std::optional<std::uint32_t> battery;
+		bool                         charging = false;
+
+		std::chrono::steady_clock::time_point updated_at;
+	};
+
+	static constexpr std::chrono::seconds tick{1};
+	static constexpr std::size_t          slot_count = 64;
+
+	static constexpr std::chrono::seconds min_interval{30};
+	static constexpr std::chrono::seconds max_interval{600};
+
+	status_poller();
+	~status_poller() noexcept;
+
+	status_poller(status_poller const&)            = delete;
+	status_poller& operator=(status_poller const&) = delete;
+
+	// Starts polling the new devices having a battery, and forgets the ones
+	// that are gone. Doesn't talk to the devices, so it's safe to call from
+	// the libusb event thread.
+	void set_drivers(drivers::identifiable_driver_map const& driver_list);
+
+	// Latest status of the device, if it's polled
+	std::optional<status> get_status(usb::address const& address) const;
+
+  private:
+	struct tracked_device {
+		std::shared_ptr<drivers::driver> driver;
+		std::shared_ptr<void>            subscription;
+
+		status               current;
+		std::chrono::seconds interval = min_interval;
+
+		// Timers set before the last schedule() are ignored
+		std::uint32_t generation = 0;
+	};
+
+	struct timer {
+		usb::address  address;
+		std::uint32_t generation;
+
+		// Full turns of the wheel left before it fires
+		std::size_t rounds;
+	};
+
+	typedef std::unordered_map<usb::address, tracked_device> device_map;
+
+	// Replaces any poll already scheduled for the device. The lock must be
+	// held.
+	void schedule(usb::address const& address,
+	              tracked_device&     device,
+	              std::chrono::seconds delay);
+
+	// Ticks the wheel is behind, since the thread last moved it. The lock
+	// must be held.
+	std::int64_t ticks_behind() const;
+
+	// Ticks from the current slot to the first timer, if there's one. The
+	// lock must be held.
+	std::optional<std::int64_t> ticks_until_next_timer() const;
+
+	// Moves the wheel to now, returns the devices to poll. The lock must be
+	// held.
+	std::vector<usb::address> advance();
+
+	void on_event(usb::address const&          address,
+	              drivers::device_event const& event);
+
+	void poll(usb::address const& address);
+
+	void run(std::stop_token stop);
+
+	mutable std::mutex                         m_mutex;
+	std::condition_variable_any                m_timers_changed;
+	bool                                       m_new_timer = false;
+	device_map                                 m_devices;
+	std::array<std::vector<timer>, slot_count> m_wheel;
+	std::size_t                                m_current_slot = 0;
+	std::minstd_rand                           m_random;
+
+	// When the wheel was at the current slot
+	std::chrono::steady_clock::time_point m_current_slot_time =
+	    std::chrono::steady_clock::now();
+
+	// Declared last, so it's stopped before anything it uses is destroyed
+	std::jthread m_thread;
+};
@@ -1,7 +1,13 @@
 #include "unix_socket.hpp"
 #include "compile_config.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <memory>
+#include <poll.h>
 #include <stdexcept>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -11,7 +17,27 @@
 
 socket_connection::socket_connection(int fd) : m_fd(fd), m_opened(true) {}
 
-socket_connection::read_result const socket_connection::read_line()
+std::shared_ptr<socket_connection> socket_connection::connect(
+    std::string const& path)
+{
+	auto const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) throw std::runtime_error("Couldn't create socket!");
+
+	sockaddr_un addr{
+	    .sun_family = AF_UNIX,
+	    .sun_path   = {},
+	};
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		::close(fd);
+		throw std::runtime_error("Couldn't connect to " + path);
+	}
+
+	return std::make_shared<socket_connection>(fd);
+}
+
+socket_connection::read_result socket_connection::read_line()
 {
 	std::string data = "";
 
@@ -20,11 +46,13 @@ socket_connection::read_result const socket_connection::read_line()
 	while (true) {
 		auto read_result = ::read(m_fd, &buffer, 1);
 
-		if (read_result < 0)
+		if (read_result < 0) {
+			close();
 			throw std::runtime_error("Can't read from socket!");
+		}
 
 		if (read_result == 0) {
-			m_opened = false;
+			close();
 			return {.data = data, .connection_is_over = true};
 		}
 
@@ -35,9 +63,150 @@ socket_connection::read_result const socket_connection::read_line()
 	return {data};
 }
 
-void socket_connection::write_string(std::string const& data) const
+socket_connection::read_result socket_connection::read_line_with_fd()
+{
+	read_result result;
+
+	while (true) {
+		char buffer{};
+		iovec io{.iov_base = &buffer, .iov_len = 1};
+
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+		msghdr message{};
+		message.msg_iov        = &io;
+		message.msg_iovlen     = 1;
+		message.msg_control    = control;
+		message.msg_controllen = sizeof(control);
+
+		auto const read_result = ::recvmsg(m_fd, &message, 0);
+
+		if (read_result < 0) {
+			close();
+			throw std::runtime_error("Can't read from socket!");
+		}
+
+		if (read_result == 0) {
+			close();
+			result.connection_is_over = true;
+			return result;
+		}
+
+		// The descriptor comes with the first byte of the line
+		for (auto* control_message = CMSG_FIRSTHDR(&message); control_message;
+		     control_message = CMSG_NXTHDR(&message, control_message)) {
+			if (control_message->cmsg_level == SOL_SOCKET &&
+			    control_message->cmsg_type == SCM_RIGHTS)
+				std::memcpy(
+				    &result.fd, CMSG_DATA(control_message), sizeof(int));
+		}
+
+		if (buffer == '\n') break;
+		result.data += buffer;
+	}
+
+	return result;
+}
+
+void socket_connection::write_string(std::string const& data)
+{
+	m_output += data;
+}
+
+void socket_connection::flush()
 {
-	::write(m_fd, data.c_str(), data.length());
+	if (m_output.empty()) return;
+
+	std::lock_guard lock(m_write_mutex);
+
+	write_all(m_output.data(), m_output.length());
+	m_output.clear();
+}
+
+void socket_connection::write_now(std::string const& data) const
+{
+	std::lock_guard lock(m_write_mutex);
+	write_all(data.data(), data.length());
+}
+
+void socket_connection::write_all(char const* data, std::size_t length) const
+{
+	while (length > 0) {
+		// MSG_NOSIGNAL: a client that went away shouldn't kill us with a
+		// SIGPIPE
+		auto const written = ::send(m_fd, data, length, MSG_NOSIGNAL);
+
+		if (written < 0) {
+			if (errno == EINTR) continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// The client's receive buffer is full, wait until it reads
+				pollfd poll_fd{.fd = m_fd, .events = POLLOUT, .revents = 0};
+				::poll(&poll_fd, 1, -1);
+				continue;
+			}
+
+			throw std::runtime_error("Can't write to socket!");
+		}
+
+		data += written;
+		length -= written;
+	}
+}
+
+void socket_connection::write_string_with_fd(std::string const& data, int fd)
+{
+	flush();
+
+	iovec io{
+	    .iov_base = const_cast<char*>(data.data()),
+	    .iov_len  = data.length(),
+	};
+
+	// Ancillary data buffer, aligned as required by the CMSG_* macros
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+	msghdr message{};
+	message.msg_iov        = &io;
+	message.msg_iovlen     = 1;
+	message.msg_control    = control;
+	message.msg_controllen = sizeof(control);
+
+	auto* control_message       = CMSG_FIRSTHDR(&message);
+	control_message->cmsg_level = SOL_SOCKET;
+	control_message->cmsg_type  = SCM_RIGHTS;
+	control_message->cmsg_len   = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(control_message), &fd, sizeof(int));
+
+	std::lock_guard lock(m_write_mutex);
+
+	auto const written = ::sendmsg(m_fd, &message, MSG_NOSIGNAL);
+	if (written < 0) throw std::runtime_error("Couldn't send file descriptor!");
+
+	// The descriptor went with the first bytes, the rest can be sent normally
+	write_all(data.data() + written, data.length() - written);
+}
+
+std::optional<uid_t> socket_connection::peer_uid() const noexcept
+{
+	ucred     credentials{};
+	socklen_t length = sizeof(credentials);
+
+	if (getsockopt(m_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0)
+		return {};
+
+	return credentials.uid;
+}
+
+void socket_connection::shutdown() const noexcept
+{
+	::shutdown(m_fd, SHUT_RDWR);
+}
+
+void socket_connection::close() noexcept
+{
+	m_opened = false;
+	m_resources.clear();
 }
 
 unix_socket::unix_socket(std::string const& path)
@@ -66,13 +235,69 @@ void unix_socket::listen() const
 }
 
 void unix_socket::wait_for_connection_and_accept(
-    std::function<void(std::shared_ptr<socket_connection>)> handler)
+    std::function<void(std::shared_ptr<socket_connection>)> handler,
+    std::optional<std::chrono::seconds>                      idle_timeout)
 {
 	while (true) {
+		if (idle_timeout.has_value()) {
+			auto const idle_for =
+			    std::chrono::steady_clock::now() - m_idle_since.load();
+			auto const idle = m_connection_count == 0;
+
+			if (idle && idle_for >= *idle_timeout) return;
+
+			// While clients are connected, check again from time to time
+			auto const wait =
+			    std::chrono::ceil<std::chrono::milliseconds>(
+			        idle ? *idle_timeout - idle_for : *idle_timeout);
+
+			pollfd poll_fd{.fd = m_fd, .events = POLLIN, .revents = 0};
+			auto const ready = ::poll(&poll_fd, 1, wait.count());
+
+			if (ready < 0 && errno != EINTR)
+				throw std::runtime_error("Couldn't wait for new clients!");
+			if (ready <= 0) continue;
+		}
+
 		auto client_fd  = accept(m_fd, nullptr, nullptr);
 		auto connection = std::make_shared<socket_connection>(client_fd);
 
+		++m_connection_count;
 		m_connections.push_back(
-		    std::make_unique<std::thread>(handler, connection));
+		    std::make_unique<std::thread>([this, handler, connection]() {
+			    handler(connection);
+
+			    m_idle_since = std::chrono::steady_clock::now();
+			    --m_connection_count;
+		    }));
+	}
+}
+
+std::optional<int> get_activated_socket()
+{
+	auto const* const listen_pid = std::getenv("LISTEN_PID");
+	auto const* const listen_fds = std::getenv("LISTEN_FDS");
+	if (!listen_pid || !listen_fds) return {};
+
+	try {
+		// Set for another process (ex. we were forked)
+		if (utils::parse_number(listen_pid, {.min = 1}, "LISTEN_PID") !=
+		    getpid())
+			return {};
+
+		utils::parse_number(listen_fds, {.min = 1}, "LISTEN_FDS");
+	} catch (std::runtime_error const&) {
+		return {};
 	}
+
+	// Meant for us only, not for what we'd start
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	// Passed sockets start at 3, we only use the first one
+	auto constexpr first_socket = 3;
+	fcntl(first_socket, F_SETFD, FD_CLOEXEC);
+
+	return first_socket;
 }
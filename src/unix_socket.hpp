@@ -1,8 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <sys/types.h>
 #include <thread>
 #include <vector>
 
@@ -10,32 +16,105 @@ class socket_connection
 {
   public:
 	struct read_result {
-		std::string const data;
-		bool              connection_is_over = false;
+		std::string data;
+		bool        connection_is_over = false;
+
+		// Only for read_line_with_fd(), -1 if no descriptor came with the
+		// line
+		int fd = -1;
 	};
 
 	socket_connection(int fd);
 
-	read_result const read_line();
-	void              write_string(std::string const&) const;
+	// Connects to a socket as a client (ex. to the daemon already running)
+	static std::shared_ptr<socket_connection> connect(std::string const& path);
+
+	read_result read_line();
+
+	// Same as read_line(), but also receives a file descriptor passed along
+	// with the line (see write_string_with_fd())
+	read_result read_line_with_fd();
+
+	// Adds the string to the response being built. Nothing is sent until
+	// flush() is called, so a whole response goes out in a single write.
+	void write_string(std::string const&);
+
+	// Sends the buffered response
+	void flush();
+
+	// Sends the string right away, without going through the response buffer.
+	// This is for writes that don't come from the command handling thread,
+	// like notifications. Those never end up in the middle of a response.
+	void write_now(std::string const&) const;
+
+	// Flushes the response, then sends the string, and passes a copy of the
+	// file descriptor to the client along with it (using SCM_RIGHTS)
+	void write_string_with_fd(std::string const&, int fd);
+
+	// Keeps a resource alive until the connection is closed
+	void bind_resource(std::shared_ptr<void> resource)
+	{
+		m_resources.push_back(resource);
+	}
 
 	bool opened() const noexcept { return m_opened; }
 
+	// The user the client process runs as (SO_PEERCRED), if it can be known
+	std::optional<uid_t> peer_uid() const noexcept;
+
+	// Ends the connection from our side. The thread reading from it will see
+	// it as closed by the client.
+	void shutdown() const noexcept;
+
   private:
+	void close() noexcept;
+
+	// Writes everything, retrying on short writes. Must be called with
+	// m_write_mutex held.
+	void write_all(char const* data, std::size_t length) const;
+
 	int  m_fd;
 	bool m_opened;
+
+	// Writes can come from both the thread handling commands and the one
+	// sending notifications
+	mutable std::mutex m_write_mutex;
+
+	std::string m_output;
+
+	std::vector<std::shared_ptr<void>> m_resources;
 };
 
 class unix_socket
 {
   public:
 	unix_socket(std::string const& path);
+
+	// Takes over a socket that's already bound (ex. one handed over by the
+	// daemon we're replacing)
+	explicit unix_socket(int fd) : m_fd(fd) {}
+
+	int fd() const noexcept { return m_fd; }
+
 	void listen() const;
+
+	// Returns once no client was connected for idle_timeout, if there's one
 	void wait_for_connection_and_accept(
-	    std::function<void(std::shared_ptr<socket_connection>)> handler);
+	    std::function<void(std::shared_ptr<socket_connection>)> handler,
+	    std::optional<std::chrono::seconds> idle_timeout = {});
 
   private:
 	int m_fd;
 
 	std::vector<std::unique_ptr<std::thread>> m_connections;
+
+	std::atomic<std::size_t> m_connection_count = 0;
+
+	// When the last client left
+	std::atomic<std::chrono::steady_clock::time_point> m_idle_since =
+	    std::chrono::steady_clock::now();
 };
+
+// The listening socket the service manager passed us, if it started us when a
+// client connected (socket activation, see sd_listen_fds(3))
+std::optional<int> get_activated_socket();
@@ -0,0 +1,59 @@
+#pragma once
+#include "utils.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace usb
+{
+
+// Identifies a USB device plugged into the computer
+struct address {
+	std::uint8_t bus;
+	std::uint8_t device;
+
+	bool operator==(const usb::address& other) const
+	{
+		return bus == other.bus && device == other.device;
+	}
+
+	std::string const stringify() const noexcept
+	{
+		// TODO: This is a hack until we get std::format. String formatting
+		//       in c++ sucks without it.
+		char buffer[8] = {0};
+
+		std::snprintf(buffer, sizeof(buffer), "%03u:%03u", bus, device);
+
+		return std::string(buffer);
+	}
+
+	static address from(std::string_view identifier_string)
+	{
+		auto const separator = identifier_string.find(':');
+		if (separator == std::string_view::npos) return {};
+
+		auto const bus = utils::parse_number<std::uint8_t>(
+		    identifier_string.substr(0, separator), {}, "Bus");
+		auto const device = utils::parse_number<std::uint8_t>(
+		    identifier_string.substr(separator + 1), {}, "Device");
+
+		return {bus, device};
+	}
+};
+
+} // namespace usb
+
+// Hashing fucntion to use usb::address as a key in a map
+// (shamelessly stolent from: https://stackoverflow.com/a/17017281/16158640)
+template <> struct std::hash<usb::address> {
+	std::size_t operator()(usb::address const& addr) const noexcept
+	{
+		std::size_t h1 = std::hash<std::uint8_t>{}(addr.bus);
+		std::size_t h2 = std::hash<std::uint8_t>{}(addr.device);
+		return h1 ^ (h2 << 1);
+	}
+};
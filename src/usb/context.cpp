@@ -22,7 +22,7 @@ std::shared_ptr<device> context::get_device(std::uint16_t vendor_id,
 	    libusb_open_device_with_vid_pid(m_context, vendor_id, product_id);
 	if (!handle) throw std::runtime_error("Couldn't open device!");
 
-	return std::make_shared<device>(device(handle));
+	return std::make_shared<device>(handle);
 }
 
 std::unordered_map<address, std::shared_ptr<device>> context::get_devices()
@@ -1,8 +1,61 @@
 #include "device.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+#include <thread>
 
 namespace usb
 {
 
+namespace
+{
+
+// Errors that may not happen again if the transfer is retried
+bool is_transient(int error) noexcept
+{
+	switch (error) {
+	case LIBUSB_ERROR_PIPE:
+	case LIBUSB_ERROR_TIMEOUT:
+	case LIBUSB_ERROR_BUSY:
+	case LIBUSB_ERROR_INTERRUPTED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// How transfers are labelled: "0x6d", or "none" when there's no data
+void format_packet(std::size_t packet, std::size_t no_packet, char (&label)[8])
+{
+	if (packet == no_packet)
+		std::snprintf(label, sizeof(label), "none");
+	else
+		std::snprintf(label, sizeof(label), "0x%02zx", packet);
+}
+
+// Two threads may look the metric up at the same time, they get the same one
+template <typename Metric, typename Lookup>
+Metric& cached(std::atomic<Metric*>& slot, Lookup const& lookup)
+{
+	auto* metric = slot.load(std::memory_order_acquire);
+	if (!metric) {
+		metric = &lookup();
+		slot.store(metric, std::memory_order_release);
+	}
+	return *metric;
+}
+
+} // namespace
+
+transfer_error::transfer_error(int code)
+    : std::runtime_error(std::string("USB transfer failed: ") +
+                         libusb_error_name(code)),
+      m_code(code)
+{
+}
+
 void device::open()
 {
 	if (is_opened()) return;
@@ -27,30 +80,160 @@ address device::get_address() const noexcept
 	        .device = libusb_get_device_address(m_device)};
 }
 
-int device::control_transfer(std::uint8_t              request_type,
-                             std::uint8_t              b_request,
-                             std::uint16_t             w_value,
-                             std::uint16_t             w_index,
-                             std::vector<std::uint8_t> data,
-                             std::uint16_t             timeout) const
+std::optional<endpoint> device::find_interrupt_in_endpoint(
+    std::uint8_t interface) const
+{
+	libusb_config_descriptor* config;
+	if (libusb_get_active_config_descriptor(m_device, &config) != 0)
+		throw std::runtime_error("Couldn't get config descriptor");
+
+	std::optional<endpoint> found;
+
+	for (auto i = 0; i < config->bNumInterfaces && !found; ++i) {
+		auto const& iface = config->interface[i];
+
+		for (auto j = 0; j < iface.num_altsetting && !found; ++j) {
+			auto const& descriptor = iface.altsetting[j];
+			if (descriptor.bInterfaceNumber != interface) continue;
+
+			for (auto k = 0; k < descriptor.bNumEndpoints; ++k) {
+				auto const& ep = descriptor.endpoint[k];
+
+				auto const is_in = (ep.bEndpointAddress &
+				                    LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+				auto const is_interrupt =
+				    (ep.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) ==
+				    LIBUSB_TRANSFER_TYPE_INTERRUPT;
+
+				if (is_in && is_interrupt) {
+					found = endpoint{ep.bEndpointAddress, ep.wMaxPacketSize};
+					break;
+				}
+			}
+		}
+	}
+
+	libusb_free_config_descriptor(config);
+	return found;
+}
+
+void device::claim_interface(std::uint8_t interface) const
 {
 	if (!is_opened()) throw std::runtime_error("Device not opened!");
 
-	libusb_detach_kernel_driver(m_handle, w_index);
-	libusb_claim_interface(m_handle, w_index);
-
-	auto size = libusb_control_transfer(m_handle,
-	                                    request_type,
-	                                    b_request,
-	                                    w_value,
-	                                    w_index,
-	                                    data.data(),
-	                                    data.size(),
-	                                    timeout);
-
-	libusb_release_interface(m_handle, w_index);
-	libusb_attach_kernel_driver(m_handle, w_index);
-	return size;
+	std::lock_guard lock(m_claims_mutex);
+
+	if (m_claims[interface]++ > 0) return;
+
+	libusb_detach_kernel_driver(m_handle, interface);
+	libusb_claim_interface(m_handle, interface);
+}
+
+void device::release_interface(std::uint8_t interface) const
+{
+	std::lock_guard lock(m_claims_mutex);
+
+	if (m_claims[interface] == 0 || --m_claims[interface] > 0) return;
+
+	libusb_release_interface(m_handle, interface);
+	libusb_attach_kernel_driver(m_handle, interface);
+}
+
+int device::control_transfer(std::uint8_t                  request_type,
+                             std::uint8_t                  b_request,
+                             std::uint16_t                 w_value,
+                             std::uint16_t                 w_index,
+                             std::span<std::uint8_t const> data,
+                             std::uint16_t                 max_timeout) const
+{
+	auto const max     = std::chrono::milliseconds(max_timeout);
+	auto       timeout = m_latency.timeout(max);
+
+	// All attempts together never wait more than max_timeout for the device
+	auto timeout_budget = max;
+
+	// Packets are told apart by their first byte, the command id
+	auto const packet = data.empty() ? no_packet : data[0];
+
+	metrics::scoped_timer timer(transfer_duration(packet));
+
+	claim_interface(w_index);
+
+	int result;
+	for (std::size_t attempt = 0;; ++attempt) {
+		auto const start = std::chrono::steady_clock::now();
+
+		result = libusb_control_transfer(
+		    m_handle,
+		    request_type,
+		    b_request,
+		    w_value,
+		    w_index,
+		    // libusb only reads it when sending
+		    const_cast<std::uint8_t*>(data.data()),
+		    data.size(),
+		    timeout.count());
+
+		if (result >= 0) {
+			m_latency.record(std::chrono::steady_clock::now() - start);
+			break;
+		}
+
+		if (!is_transient(result) || attempt == max_retries) break;
+
+		// The device may just be slower than usual, so it gets twice as long,
+		// if that still fits. Until the tracker adapted, the first attempt
+		// used all of max_timeout: the device most likely can't answer (ex.
+		// a sleeping wireless mouse), which is for the caller to handle.
+		if (result == LIBUSB_ERROR_TIMEOUT) {
+			timeout_budget -= timeout;
+			timeout *= 2;
+			if (timeout > timeout_budget) break;
+		}
+
+		transfer_retries(packet).add();
+		std::this_thread::sleep_for(retry_backoff * (1 << attempt));
+	}
+
+	release_interface(w_index);
+
+	if (result < 0) {
+		char packet_label[8];
+		format_packet(packet, no_packet, packet_label);
+
+		metrics::get_counter("openfdd_usb_transfer_errors_total",
+		                     {{"device", get_address().stringify()},
+		                      {"packet", packet_label},
+		                      {"error", libusb_error_name(result)}})
+		    .add();
+		throw transfer_error(result);
+	}
+
+	return result;
+}
+
+metrics::histogram& device::transfer_duration(std::size_t packet) const
+{
+	return cached(m_transfer_durations[packet], [&]() -> metrics::histogram& {
+		char packet_label[8];
+		format_packet(packet, no_packet, packet_label);
+
+		return metrics::get_histogram("openfdd_usb_transfer_duration_seconds",
+		                              {{"device", get_address().stringify()},
+		                               {"packet", packet_label}});
+	});
+}
+
+metrics::counter& device::transfer_retries(std::size_t packet) const
+{
+	return cached(m_transfer_retries[packet], [&]() -> metrics::counter& {
+		char packet_label[8];
+		format_packet(packet, no_packet, packet_label);
+
+		return metrics::get_counter("openfdd_usb_transfer_retries_total",
+		                            {{"device", get_address().stringify()},
+		                             {"packet", packet_label}});
+	});
 }
 
 } // namespace usb
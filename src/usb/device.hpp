@@ -1,8 +1,25 @@
 #pragma once
 #include "libusb-1.0/libusb.h"
+#include "usb/address.hpp"
+#include "usb/latency_tracker.hpp"
 #include "utils.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace metrics
+{
+class counter;
+class histogram;
+} // namespace metrics
 
 namespace usb
 {
@@ -12,39 +29,22 @@ struct descriptor_id {
 	std::uint16_t id_product;
 };
 
-// Identifies a USB device plugged into the computer
-struct address {
-	std::uint8_t bus;
-	std::uint8_t device;
-
-	bool operator==(const usb::address& other) const
-	{
-		return bus == other.bus && device == other.device;
-	}
-
-	std::string const stringify() const noexcept
-	{
-		// TODO: This is a hack until we get std::format. String formatting
-		//       in c++ sucks without it.
-		char buffer[8] = {0};
-
-		std::snprintf(buffer, sizeof(buffer), "%03u:%03u", bus, device);
+// A transfer that failed, even after being retried
+class transfer_error : public std::runtime_error
+{
+  public:
+	transfer_error(int code);
 
-		return std::string(buffer);
-	}
+	// The libusb error (LIBUSB_ERROR_*)
+	int code() const noexcept { return m_code; }
 
-	static address from(std::string const& identifier_string)
-	{
-		auto const& split_id = utils::split(identifier_string, ':');
-		if (split_id.size() < 2) return {};
-
-		std::uint8_t bus =
-		    utils::stoi_safe(split_id[0], {.min = 0, .max = 256}, "Bus");
-		std::uint8_t device =
-		    utils::stoi_safe(split_id[1], {.min = 0, .max = 256}, "Device");
+  private:
+	int m_code;
+};
 
-		return {bus, device};
-	}
+struct endpoint {
+	std::uint8_t  address;
+	std::uint16_t max_packet_size;
 };
 
 class device
@@ -57,6 +57,9 @@ class device
 
 	device(libusb_device* device) noexcept : m_device(device) {}
 
+	device(device const&)            = delete;
+	device& operator=(device const&) = delete;
+
 	~device() noexcept
 	{
 		if (is_opened()) libusb_close(m_handle);
@@ -70,29 +73,66 @@ class device
 
 	address get_address() const noexcept;
 
+	// Finds the first interrupt IN endpoint of an interface, used by devices
+	// to report events to the host.
+	std::optional<endpoint> find_interrupt_in_endpoint(
+	    std::uint8_t interface) const;
+
+	// Claims the interface, detaching the kernel driver from it if needed.
+	// Claims are counted, so an interface stays claimed as long as someone
+	// is using it (e.g. an interrupt_reader), and is only given back to the
+	// kernel after the last release_interface().
+	void claim_interface(std::uint8_t interface) const;
+	void release_interface(std::uint8_t interface) const;
+
 	// TODO: Find better arguements to pass (request direction, recipient,
 	// ...)
 	// TODO: Use enums when possible
-	int control_transfer(std::uint8_t              request_type,
-	                     std::uint8_t              b_request,
-	                     std::uint16_t             w_value,
-	                     std::uint16_t             w_index,
-	                     std::vector<std::uint8_t> data,
-	                     std::uint16_t             timeout) const;
+	// Only sends data to the device (the data isn't written to), so it can
+	// come from anywhere, like a packet_builder on the stack.
+	//
+	// The timeout adapts to how fast the device answered the last transfers
+	// (see latency_tracker), up to max_timeout. Transient errors (stalls,
+	// timeouts, ...) are retried a few times, then reported by throwing a
+	// transfer_error, like any other error. Timeouts are only retried while
+	// the attempts fit in max_timeout altogether.
+	int control_transfer(std::uint8_t                  request_type,
+	                     std::uint8_t                  b_request,
+	                     std::uint16_t                 w_value,
+	                     std::uint16_t                 w_index,
+	                     std::span<std::uint8_t const> data,
+	                     std::uint16_t                 max_timeout) const;
+
+	latency_tracker const& latency() const noexcept { return m_latency; }
+
+	// Retries after a transient error, waiting retry_backoff before the
+	// first one, and twice as long before each of the next ones
+	static constexpr std::size_t               max_retries = 2;
+	static constexpr std::chrono::milliseconds retry_backoff{10};
 
   private:
+	friend class interrupt_reader;
+
 	libusb_device_handle* m_handle = nullptr;
 	libusb_device*        m_device;
-};
-} // namespace usb
 
-// Hashing fucntion to use usb::address as a key in a map
-// (shamelessly stolent from: https://stackoverflow.com/a/17017281/16158640)
-template <> struct std::hash<usb::address> {
-	std::size_t operator()(usb::address const& addr) const noexcept
-	{
-		std::size_t h1 = std::hash<std::uint8_t>{}(addr.bus);
-		std::size_t h2 = std::hash<std::uint8_t>{}(addr.device);
-		return h1 ^ (h2 << 1);
-	}
+	mutable std::mutex                                    m_claims_mutex;
+	mutable std::unordered_map<std::uint8_t, std::size_t> m_claims;
+
+	mutable latency_tracker m_latency;
+
+	// Transfer metrics by packet id (the first byte), no_packet for empty
+	// transfers. Found in the registry on the first transfer of each id, so
+	// the next ones only update atomics.
+	static constexpr std::size_t no_packet = 256;
+
+	template <typename Metric>
+	using metric_cache = std::array<std::atomic<Metric*>, no_packet + 1>;
+
+	mutable metric_cache<metrics::histogram> m_transfer_durations{};
+	mutable metric_cache<metrics::counter>   m_transfer_retries{};
+
+	metrics::histogram& transfer_duration(std::size_t packet) const;
+	metrics::counter&   transfer_retries(std::size_t packet) const;
 };
+} // namespace usb
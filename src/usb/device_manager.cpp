@@ -1,15 +1,30 @@
 #include "usb/device_manager.hpp"
+#include "metrics.hpp"
 #include "usb/context.hpp"
 #include "usb/device.hpp"
 #include "utils.hpp"
 #include <libusb-1.0/libusb.h>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <thread>
 
 namespace usb
 {
 
+std::unordered_map<usb::address, std::shared_ptr<usb::device>>
+device_manager::devices()
+{
+	std::lock_guard lock(m_mutex);
+
+	if (!m_enumerated) {
+		m_device_list = m_context.get_devices();
+		m_enumerated  = true;
+	}
+
+	return m_device_list;
+}
+
 void device_manager::handle_hotplugs()
 {
 	if (!usb::context::supports_hotplug())
@@ -21,7 +36,14 @@ void device_manager::handle_hotplugs()
 	       libusb_device*       device,
 	       libusb_hotplug_event event,
 	       void*                data) -> int {
-		    utils::daemon::log("Device got hot(un)plugged!");
+		    // Includes updating the drivers, which is most of the work
+		    static auto& duration =
+		        metrics::get_histogram("openfdd_hotplug_duration_seconds");
+		    metrics::scoped_timer timer(duration);
+
+		    auto const arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+		    utils::daemon::log("Device got hot(un)plugged!",
+		                       {{"event", arrived ? "arrived" : "left"}});
 
 		    auto this_ = (device_manager*)data;
 
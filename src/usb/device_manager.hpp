@@ -4,6 +4,7 @@
 #include "usb/device.hpp"
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <unordered_map>
 
@@ -13,28 +14,28 @@ namespace usb
 class device_manager
 {
   public:
-	device_manager(usb::context const& context) : m_context(context)
-	{
-		m_device_list = context.get_devices();
-	}
+	// Devices aren't listed until devices() is first called
+	device_manager(usb::context const& context) : m_context(context) {}
 
 	inline void register_device(std::shared_ptr<usb::device> device)
 	{
-		m_device_list[device->get_address()] = device;
+		std::lock_guard lock(m_mutex);
+
+		// Otherwise, the device will be there when the devices get listed
+		if (m_enumerated) m_device_list[device->get_address()] = device;
 	}
 
 	inline void unregister_device(usb::address address_of_device_to_remove)
 	{
+		std::lock_guard lock(m_mutex);
 		m_device_list.erase(address_of_device_to_remove);
 	}
 
 	void handle_hotplugs();
 
-	std::unordered_map<usb::address, std::shared_ptr<usb::device>> const&
-	devices() const noexcept
-	{
-		return m_device_list;
-	}
+	// Lists the devices the first time it's called. After that, the list is
+	// kept up to date by hotplugs.
+	std::unordered_map<usb::address, std::shared_ptr<usb::device>> devices();
 
 	void set_hotplug_notification(
 	    std::function<void()> notification_callback) noexcept
@@ -44,6 +45,10 @@ class device_manager
 
   private:
 	usb::context const& m_context;
+
+	// Hotplugs come from the libusb event thread
+	std::mutex m_mutex;
+	bool       m_enumerated = false;
 	std::unordered_map<usb::address, std::shared_ptr<usb::device>>
 	    m_device_list;
 
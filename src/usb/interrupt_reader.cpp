@@ -0,0 +1,117 @@
+#include "usb/interrupt_reader.hpp"
+#include "utils.hpp"
+#include <stdexcept>
+
+namespace usb
+{
+
+interrupt_reader::interrupt_reader(std::shared_ptr<device> dev,
+                                   std::uint8_t            interface,
+                                   report_handler          handler)
+    : m_state(std::make_shared<state>())
+{
+	auto const endpoint = dev->find_interrupt_in_endpoint(interface);
+	if (!endpoint.has_value())
+		throw std::runtime_error("No interrupt endpoint on interface " +
+		                         std::to_string(interface));
+
+	dev->claim_interface(interface);
+
+	m_state->dev       = dev;
+	m_state->interface = interface;
+	m_state->handler   = handler;
+
+	m_state->buffers.resize(
+	    transfer_count, std::vector<std::uint8_t>(endpoint->max_packet_size));
+
+	for (auto& buffer : m_state->buffers) {
+		auto* transfer = libusb_alloc_transfer(0);
+		if (!transfer) throw std::runtime_error("Couldn't allocate transfer");
+
+		libusb_fill_interrupt_transfer(transfer,
+		                               dev->m_handle,
+		                               endpoint->address,
+		                               buffer.data(),
+		                               buffer.size(),
+		                               on_transfer_completed,
+		                               m_state.get(),
+		                               0); // No timeout, wait for reports
+		                                   // as long as needed
+		m_state->transfers.push_back(transfer);
+	}
+
+	std::lock_guard lock(m_state->mutex);
+	for (auto* transfer : m_state->transfers)
+		m_state->submit(transfer);
+}
+
+interrupt_reader::~interrupt_reader() noexcept
+{
+	std::lock_guard lock(m_state->mutex);
+	m_state->stopping = true;
+
+	if (m_state->in_flight == 0) return;
+
+	// The cancellations complete asynchronously, on the event thread. The
+	// state is released by the last one.
+	m_state->keep_alive = m_state;
+	for (auto* transfer : m_state->transfers)
+		libusb_cancel_transfer(transfer);
+}
+
+interrupt_reader::state::~state() noexcept
+{
+	for (auto* transfer : transfers)
+		libusb_free_transfer(transfer);
+
+	if (dev) dev->release_interface(interface);
+}
+
+void interrupt_reader::state::submit(libusb_transfer* transfer)
+{
+	// Must be called with the mutex held
+	if (libusb_submit_transfer(transfer) == LIBUSB_SUCCESS) {
+		++in_flight;
+		return;
+	}
+
+	utils::daemon::log("Interrupt reader: couldn't submit transfer",
+	                   utils::daemon::log_level::error);
+}
+
+void LIBUSB_CALL
+interrupt_reader::on_transfer_completed(libusb_transfer* transfer)
+{
+	auto* const this_ = static_cast<state*>(transfer->user_data);
+
+	// Released after unlocking, as it may destroy the state (and its mutex)
+	std::shared_ptr<state> released;
+
+	std::lock_guard lock(this_->mutex);
+	--this_->in_flight;
+
+	auto const status = transfer->status;
+
+	if (this_->stopping) {
+		if (this_->in_flight == 0) released = std::move(this_->keep_alive);
+		return;
+	}
+
+	if (status == LIBUSB_TRANSFER_COMPLETED)
+		this_->handler({transfer->buffer,
+		                static_cast<std::size_t>(transfer->actual_length)});
+
+	// Timeouts just mean we should keep listening. The device going away or
+	// errors mean we're done.
+	auto const should_resubmit = status == LIBUSB_TRANSFER_COMPLETED ||
+	                             status == LIBUSB_TRANSFER_TIMED_OUT ||
+	                             status == LIBUSB_TRANSFER_OVERFLOW;
+
+	if (should_resubmit)
+		this_->submit(transfer);
+	else if (status != LIBUSB_TRANSFER_NO_DEVICE)
+		utils::daemon::log("Interrupt reader: transfer failed, stopping",
+		                   utils::daemon::log_level::error);
+}
+
+} // namespace usb
@@ -0,0 +1,72 @@
+#pragma once
+#include "usb/device.hpp"
+#include <cstdint>
+#include <functional>
+#include <libusb-1.0/libusb.h>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace usb
+{
+
+// Continuously reads the reports a device sends on an interrupt IN endpoint.
+//
+// A few transfers are kept submitted at all times, and are re-submitted from
+// their completion callback, so a report is picked up as soon as the device
+// sends it, without us having to poll.
+//
+// Completion callbacks run from the thread handling libusb events (see
+// device_manager::handle_hotplugs), so report handlers should be quick.
+class interrupt_reader
+{
+  public:
+	typedef std::function<void(std::span<std::uint8_t const> report)>
+	    report_handler;
+
+	// Number of transfers kept in flight. Having more than one means reports
+	// sent while the handler runs aren't lost.
+	static constexpr std::size_t transfer_count = 2;
+
+	interrupt_reader(std::shared_ptr<device> dev,
+	                 std::uint8_t            interface,
+	                 report_handler          handler);
+
+	// Doesn't wait for the transfers to be cancelled, so this can safely be
+	// called from the libusb event thread. The handler isn't called anymore
+	// once this returns.
+	~interrupt_reader() noexcept;
+
+	interrupt_reader(interrupt_reader const&)            = delete;
+	interrupt_reader& operator=(interrupt_reader const&) = delete;
+
+  private:
+	// Everything the transfers need. It lives until the last transfer is
+	// done, which can be after the reader is destroyed.
+	struct state {
+		~state() noexcept;
+
+		void submit(libusb_transfer*);
+
+		std::shared_ptr<device> dev;
+		std::uint8_t            interface;
+		report_handler          handler;
+
+		std::vector<libusb_transfer*>          transfers;
+		std::vector<std::vector<std::uint8_t>> buffers;
+
+		std::mutex  mutex;
+		std::size_t in_flight = 0;
+		bool        stopping  = false;
+
+		// Set while stopping with transfers still in flight
+		std::shared_ptr<state> keep_alive;
+	};
+
+	static void LIBUSB_CALL on_transfer_completed(libusb_transfer*);
+
+	std::shared_ptr<state> m_state;
+};
+
+} // namespace usb
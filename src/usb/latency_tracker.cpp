@@ -0,0 +1,58 @@
+#include "latency_tracker.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace usb
+{
+
+void latency_tracker::record(
+    std::chrono::steady_clock::duration latency) noexcept
+{
+	auto const milliseconds =
+	    std::chrono::ceil<std::chrono::milliseconds>(latency).count();
+
+	std::lock_guard lock(m_mutex);
+
+	m_samples[m_next] = std::clamp<std::int64_t>(
+	    milliseconds, 0, std::numeric_limits<std::uint16_t>::max());
+	m_next = (m_next + 1) % sample_count;
+	if (m_count < sample_count) ++m_count;
+}
+
+std::optional<std::chrono::milliseconds> latency_tracker::percentile(
+    unsigned percent) const
+{
+	std::array<std::uint16_t, sample_count> sorted;
+	std::size_t                             count;
+
+	{
+		std::lock_guard lock(m_mutex);
+		sorted = m_samples;
+		count  = m_count;
+	}
+
+	if (count == 0) return {};
+
+	auto const nth =
+	    sorted.begin() + (count - 1) * std::min(percent, 100u) / 100;
+	std::nth_element(sorted.begin(), nth, sorted.begin() + count);
+
+	return std::chrono::milliseconds(*nth);
+}
+
+std::chrono::milliseconds latency_tracker::timeout(
+    std::chrono::milliseconds max_timeout) const
+{
+	{
+		std::lock_guard lock(m_mutex);
+		if (m_count < min_sample_count) return max_timeout;
+	}
+
+	auto const p95 = percentile(95).value_or(max_timeout);
+
+	return std::clamp(p95 * timeout_factor,
+	                  std::min(min_timeout, max_timeout),
+	                  max_timeout);
+}
+
+} // namespace usb
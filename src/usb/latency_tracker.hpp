@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace usb
+{
+
+// Remembers how long the last transfers to a device took, to give the next
+// ones a timeout fitting how fast the device usually answers, instead of a
+// fixed one long enough for the slowest devices.
+class latency_tracker
+{
+  public:
+	// Number of transfers remembered
+	static constexpr std::size_t sample_count = 32;
+
+	// Until this many transfers were recorded, the maximum timeout is used
+	static constexpr std::size_t min_sample_count = 8;
+
+	// Timeouts are this many times the 95th percentile
+	static constexpr unsigned timeout_factor = 4;
+
+	// Never wait less than this, so a little jitter doesn't cause timeouts
+	static constexpr std::chrono::milliseconds min_timeout{50};
+
+	void record(std::chrono::steady_clock::duration latency) noexcept;
+
+	// Latency under which `percent` of the recorded transfers were, if any
+	// were recorded
+	std::optional<std::chrono::milliseconds> percentile(unsigned percent) const;
+
+	std::chrono::milliseconds timeout(
+	    std::chrono::milliseconds max_timeout) const;
+
+  private:
+	mutable std::mutex m_mutex;
+
+	// Ring buffer of latencies, in milliseconds
+	std::array<std::uint16_t, sample_count> m_samples = {};
+	std::size_t                             m_next    = 0;
+	std::size_t                             m_count   = 0;
+};
+
+} // namespace usb
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+namespace usb
+{
+
+// Builds a packet of at most `capacity` bytes, on the stack, so sending it
+// doesn't allocate. Values are written one after the other, starting at the
+// offset given by at(), and bytes that weren't written are 0:
+//
+//  usb::packet_builder<64> packet;
+//  packet.u8(0x6b).u8(interval - 1).pad_to(64);
+//
+//  device.control_transfer(0x21, 0x09, 0x0200, 3, packet.bytes(), 1000);
+template <std::size_t capacity> class packet_builder
+{
+  public:
+	// Moves where the next value is written
+	packet_builder& at(std::size_t offset)
+	{
+		if (offset > capacity) throw std::runtime_error("Packet too big");
+		m_cursor = offset;
+		return *this;
+	}
+
+	packet_builder& u8(std::uint8_t value)
+	{
+		reserve(1);
+		m_data[m_cursor++] = value;
+		return *this;
+	}
+
+	packet_builder& u16le(std::uint16_t value)
+	{
+		reserve(2);
+		m_data[m_cursor++] = value & 0xff;
+		m_data[m_cursor++] = (value >> 8) & 0xff;
+		return *this;
+	}
+
+	packet_builder& u32le(std::uint32_t value)
+	{
+		reserve(4);
+		m_data[m_cursor++] = value & 0xff;
+		m_data[m_cursor++] = (value >> 8) & 0xff;
+		m_data[m_cursor++] = (value >> 16) & 0xff;
+		m_data[m_cursor++] = (value >> 24) & 0xff;
+		return *this;
+	}
+
+	packet_builder& rgb(std::uint8_t r, std::uint8_t g, std::uint8_t b)
+	{
+		return u8(r).u8(g).u8(b);
+	}
+
+	// Writes a value from `from_min` to `from_max` as a byte from 0 to
+	// `to_max` (ex. a DPI the device takes as 0 to 0xd6). Values out of
+	// range are clamped instead of wrapping.
+	packet_builder& scaled(std::int64_t value,
+	                       std::int64_t from_min,
+	                       std::int64_t from_max,
+	                       std::uint8_t to_max)
+	{
+		auto const scaled_value =
+		    ((float)(value - from_min) / (from_max - from_min)) * to_max;
+
+		if (scaled_value > to_max) return u8(to_max);
+		if (scaled_value < 0) return u8(0);
+		return u8(scaled_value);
+	}
+
+	// Makes the packet at least `packet_size` bytes long, the new bytes
+	// being 0
+	packet_builder& pad_to(std::size_t packet_size)
+	{
+		if (packet_size > capacity) throw std::runtime_error("Packet too big");
+		if (packet_size > m_size) m_size = packet_size;
+		return *this;
+	}
+
+	std::size_t size() const noexcept { return m_size; }
+
+	std::span<std::uint8_t const> bytes() const noexcept
+	{
+		return std::span(m_data).first(m_size);
+	}
+
+  private:
+	void reserve(std::size_t count)
+	{
+		if (m_cursor + count > capacity)
+			throw std::runtime_error("Packet too big");
+		if (m_cursor + count > m_size) m_size = m_cursor + count;
+	}
+
+	std::array<std::uint8_t, capacity> m_data = {};
+	std::size_t                        m_cursor = 0;
+	std::size_t                        m_size   = 0;
+};
+
+} // namespace usb
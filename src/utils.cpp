@@ -1,13 +1,12 @@
 #include "utils.hpp"
 #include "compile_config.hpp"
-#include <csignal>
+#include "logger.hpp"
+#include <cerrno>
 #include <cstdlib>
-#include <filesystem>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/syslog.h>
 #include <syslog.h>
@@ -20,18 +19,43 @@ namespace utils
 namespace daemon
 {
 
-void log(std::string const& message, log_level ll)
+namespace
 {
-	if constexpr (!compile_config::use_daemon)
-		// TODO: Handle log level when not running as a daemon
-		std::cout << "syslog: " << message << std::endl;
-	else
-		syslog(ll, "%s", message.c_str());
+
+logger& get_logger()
+{
+	static logger instance;
+	return instance;
+}
+
+} // namespace
+
+void set_log_level(log_level ll) noexcept
+{
+	get_logger().set_level(ll);
+}
+
+void write_log(log_level                        ll,
+               std::string_view                 message,
+               std::initializer_list<log_field> fields)
+{
+	get_logger().push(ll, message, fields);
+}
+
+void start_log_writer()
+{
+	get_logger().start();
+}
+
+void flush_log()
+{
+	get_logger().flush();
 }
 
 void exit_error(std::string const& error)
 {
 	log(error, log_level::error);
+	flush_log();
 	exit(EXIT_FAILURE);
 }
 
@@ -80,66 +104,129 @@ void become()
 	close(STDERR_FILENO);
 }
 
-} // namespace daemon
+pid_file::pid_file(std::string const& path)
+{
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	// Not being root is enough to check if the daemon runs
+	if (m_fd < 0 && errno == EACCES)
+		m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (m_fd < 0) throw std::runtime_error("Couldn't open " + path);
+}
+
+pid_file::~pid_file() noexcept
+{
+	// Releases the lock
+	close(m_fd);
+}
 
-int stoi_safe(std::string input,
-              stoi_checks checks,
-              std::string value_name_for_error)
+bool pid_file::try_lock()
 {
-	int converted = 0;
-	try {
-		converted = std::stoi(input);
-	} catch (std::invalid_argument const& e) {
-		throw std::runtime_error(value_name_for_error +
-		                         " should be a number (got: " + input + ")");
+	if (flock(m_fd, LOCK_EX | LOCK_NB) < 0) {
+		if (errno == EWOULDBLOCK) return false;
+		throw std::runtime_error("Couldn't lock the PID file");
 	}
 
-	if (checks.min.has_value() && converted < checks.min.value())
-		throw std::runtime_error(value_name_for_error + " should be >" +
-		                         std::to_string(checks.min.value()));
-	if (checks.max.has_value() && converted > checks.max.value())
-		throw std::runtime_error(value_name_for_error + " should be <" +
-		                         std::to_string(checks.max.value()));
+	write_pid();
+	return true;
+}
+
+void pid_file::lock()
+{
+	while (flock(m_fd, LOCK_EX) < 0)
+		if (errno != EINTR)
+			throw std::runtime_error("Couldn't lock the PID file");
 
-	return converted;
+	write_pid();
 }
 
-std::vector<std::string> split(std::string const& input, char delimiter)
+std::optional<int> pid_file::owner() const
 {
-	std::stringstream stream(input);
+	// If we can get a shared lock, nobody holds the exclusive one
+	if (flock(m_fd, LOCK_SH | LOCK_NB) == 0) {
+		flock(m_fd, LOCK_UN);
+		return {};
+	}
 
-	std::vector<std::string> result{};
+	char buffer[16] = {};
+	auto const size = pread(m_fd, buffer, sizeof(buffer) - 1, 0);
+	if (size <= 0) return {};
 
-	std::string part;
-	while (std::getline(stream, part, delimiter))
-		result.push_back(part);
+	// The daemon may be writing it right now, don't trust a partial PID
+	auto const pid = std::string_view(buffer, size);
+	if (pid.back() != '\n') return {};
 
-	return result;
+	return parse_number(pid.substr(0, pid.size() - 1), {.min = 1}, "PID");
 }
 
-void kill_all(std::string const& process_name)
+void pid_file::write_pid() const
 {
-	for (auto const& current_process_dir :
-	     std::filesystem::directory_iterator("/proc/")) {
+	auto const pid = std::to_string(getpid()) + '\n';
 
-		std::ifstream cmdline_file(current_process_dir.path().string() +
-		                           "/cmdline");
+	if (ftruncate(m_fd, 0) < 0 ||
+	    pwrite(m_fd, pid.data(), pid.size(), 0) != (ssize_t)pid.size())
+		throw std::runtime_error("Couldn't write the PID file");
+}
+
+} // namespace daemon
 
-		std::string executable_name;
-		cmdline_file >>
-		    executable_name; // This works because the cmdline file contains
-		                     // argv separated by NULL bytes, so reading until
-		                     // the first \0 gets us argv[0]
+tokens tokenize(std::string& input, char delimiter)
+{
+	tokens result;
+
+	// Unescaping only ever shrinks the input, so we can compact it in place:
+	// `write` never goes past `read`, and the tokens already found are never
+	// touched again.
+	std::size_t token_start = 0;
+	std::size_t write       = 0;
+
+	for (std::size_t read = 0; read < input.size(); ++read) {
+		auto const chr = input[read];
+
+		if (chr == '\\' && read + 1 < input.size() &&
+		    input[read + 1] == delimiter) {
+			input[write++] = delimiter;
+			++read;
+			continue;
+		}
 
-		if (executable_name == process_name) {
-			auto const& pid_string = current_process_dir.path().stem().string();
-			if (kill(std::stoi(pid_string), SIGTERM) < 0)
-				throw std::runtime_error("Couldn't kill process " + pid_string);
+		if (chr == delimiter) {
+			result.push_back({input.data() + token_start, write - token_start});
+			token_start = write;
+			continue;
 		}
+
+		input[write++] = chr;
 	}
+
+	// Like getline, a trailing delimiter doesn't make an empty token
+	if (write > token_start || result.empty())
+		result.push_back({input.data() + token_start, write - token_start});
+
+	return result;
+}
+
+tokens tokenize_view(std::string_view input, char delimiter)
+{
+	tokens result;
+
+	std::size_t token_start = 0;
+	std::size_t token_end   = 0;
+	while ((token_end = input.find(delimiter, token_start)) !=
+	       std::string_view::npos) {
+		result.push_back(input.substr(token_start, token_end - token_start));
+		token_start = token_end + 1;
+	}
+
+	// Like tokenize, a trailing delimiter doesn't make an empty token
+	if (token_start < input.size() || result.empty())
+		result.push_back(input.substr(token_start));
+
+	return result;
 }
 
-std::string escape_commas(std::string const& input)
+std::string escape_commas(std::string_view input)
 {
 	std::string output;
 
@@ -1,8 +1,19 @@
 #pragma once
 
+#include "compile_config.hpp"
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <limits>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 namespace utils
 {
@@ -12,26 +23,131 @@ namespace daemon
 
 #include <sys/syslog.h>
 
+// From the most important to the least, like syslog's
 enum log_level {
-	notice = LOG_NOTICE,
-	error  = LOG_ERR,
+	error   = LOG_ERR,
+	warning = LOG_WARNING,
+	notice  = LOG_NOTICE,
+	info    = LOG_INFO,
+	debug   = LOG_DEBUG,
 };
 
-void log(std::string const& message, log_level ll = log_level::notice);
+// A value logged along with a message, as key=value. Identical messages are
+// rate limited, so what changes from one to the next (ex. the device) should
+// go in fields, not in the message.
+struct log_field {
+	std::string_view key;
+	std::string_view value;
+};
+
+// Messages less important than the level aren't logged. Defaults to notice.
+void set_log_level(log_level ll) noexcept;
+
+// Doesn't wait for the message to be written (see logger), so it's fine to
+// call from the libusb event thread
+void write_log(log_level                        ll,
+               std::string_view                 message,
+               std::initializer_list<log_field> fields);
+
+// Levels above compile_config::max_log_level are compiled out
+inline void log(std::string_view message, log_level ll = log_level::notice)
+{
+	if (ll <= compile_config::max_log_level) write_log(ll, message, {});
+}
+
+inline void log(std::string_view                 message,
+                std::initializer_list<log_field> fields,
+                log_level                        ll = log_level::notice)
+{
+	if (ll <= compile_config::max_log_level) write_log(ll, message, fields);
+}
+
+// Messages are written from another thread once this is called, and right
+// away before. Call it after become(), threads don't survive fork().
+void start_log_writer();
+
+// Writes the messages still waiting. Must be called before exiting without
+// running destructors (std::_Exit).
+void flush_log();
 
 void exit_error(std::string const& error);
 
 // Call this to become a daemon
 void become();
 
+// A file holding the daemon's PID, locked (with flock) for as long as the
+// daemon runs. The kernel drops the lock when the process dies, so a file left
+// behind by a crash isn't mistaken for a running daemon.
+class pid_file
+{
+  public:
+	pid_file(std::string const& path);
+	~pid_file() noexcept;
+
+	pid_file(pid_file const&)            = delete;
+	pid_file& operator=(pid_file const&) = delete;
+
+	// Takes the lock, and writes our PID in the file. Returns false if
+	// another daemon holds it.
+	bool try_lock();
+
+	// Same, but waits for the other daemon to let go of the lock
+	void lock();
+
+	// PID of the daemon holding the lock, if one is running
+	std::optional<int> owner() const;
+
+	// The lock is kept across fork(), but the PID has to be written again
+	void write_pid() const;
+
+  private:
+	int m_fd;
+};
+
 } // namespace daemon
 
-struct stoi_checks {
-	std::optional<int> min;
-	std::optional<int> max;
+struct number_checks {
+	std::optional<std::int64_t> min = {};
+	std::optional<std::int64_t> max = {};
 };
 
-int stoi_safe(std::string input, stoi_checks, std::string value_name_for_error);
+// Parses a number, throwing if it isn't one or isn't in range. This doesn't
+// allocate, except to build the error message.
+template <std::integral T = int>
+T parse_number(std::string_view input,
+               number_checks    checks,
+               std::string_view value_name_for_error,
+               int              base = 10)
+{
+	std::int64_t converted = 0;
+
+	auto const* const input_end = input.data() + input.size();
+	auto const [end, error] =
+	    std::from_chars(input.data(), input_end, converted, base);
+
+	if (input.empty() || error != std::errc{} || end != input_end)
+		throw std::runtime_error(std::string(value_name_for_error) +
+		                         " should be a number (got: " +
+		                         std::string(input) + ")");
+
+	if (checks.min.has_value() && converted < checks.min.value())
+		throw std::runtime_error(std::string(value_name_for_error) +
+		                         " should be >" +
+		                         std::to_string(checks.min.value()));
+	if (checks.max.has_value() && converted > checks.max.value())
+		throw std::runtime_error(std::string(value_name_for_error) +
+		                         " should be <" +
+		                         std::to_string(checks.max.value()));
+
+	// Whatever the checks, never silently truncate the value
+	if (std::cmp_less(converted, std::numeric_limits<T>::min()) ||
+	    std::cmp_greater(converted, std::numeric_limits<T>::max()))
+		throw std::runtime_error(std::string(value_name_for_error) +
+		                         " is out of range (got: " +
+		                         std::string(input) + ")");
+
+	return static_cast<T>(converted);
+}
 
 void ensure_range(auto        value,
                   auto        min,
@@ -52,10 +168,69 @@ constexpr auto scale(
 	       to_min;
 }
 
-std::vector<std::string> split(std::string const& input, char delimiter);
+// Vector storing its first N elements inline, and only allocating if it
+// grows past that
+template <typename T, std::size_t N> class small_vector
+{
+  public:
+	void push_back(T const& value)
+	{
+		if (m_size < N)
+			m_inline[m_size] = value;
+		else {
+			if (m_size == N) m_heap.assign(m_inline.begin(), m_inline.end());
+			m_heap.push_back(value);
+		}
+		++m_size;
+	}
+
+	T* data() noexcept { return m_size > N ? m_heap.data() : m_inline.data(); }
+	T const* data() const noexcept
+	{
+		return m_size > N ? m_heap.data() : m_inline.data();
+	}
+
+	std::size_t size() const noexcept { return m_size; }
+	bool        empty() const noexcept { return m_size == 0; }
+
+	T&       operator[](std::size_t i) noexcept { return data()[i]; }
+	T const& operator[](std::size_t i) const noexcept { return data()[i]; }
+
+	T*       begin() noexcept { return data(); }
+	T*       end() noexcept { return data() + m_size; }
+	T const* begin() const noexcept { return data(); }
+	T const* end() const noexcept { return data() + m_size; }
+
+  private:
+	std::array<T, N> m_inline{};
+	std::vector<T>   m_heap;
+	std::size_t      m_size = 0;
+};
+
+typedef small_vector<std::string_view, 16> tokens;
+
+// Splits the input on the delimiter, without copying anything: the tokens
+// point into the input.
+// A delimiter preceded by a '\' (see escape_commas) is part of the token,
+// the input is unescaped in place.
+tokens tokenize(std::string& input, char delimiter);
 
-void kill_all(std::string const& process_name);
+// Same as tokenize, for input that can't be modified: escaped delimiters
+// aren't supported.
+tokens tokenize_view(std::string_view input, char delimiter);
+
+// Hash allowing unordered containers keyed by std::string to be looked up
+// with a std::string_view, without building a string.
+// Use with std::equal_to<> as the key equality.
+struct string_hash {
+	using is_transparent = void;
+
+	std::size_t operator()(std::string_view value) const noexcept
+	{
+		return std::hash<std::string_view>{}(value);
+	}
+};
 
-std::string escape_commas(std::string const& input);
+std::string escape_commas(std::string_view input);
 
 } // namespace utils